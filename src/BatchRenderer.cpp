@@ -0,0 +1,411 @@
+#include "BatchRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "Camera.h"
+#include "ManagerEnvironmentConfiguration.h"
+#include "Model.h"
+
+#include "Constants.h"
+#include "Utils.h"
+#include "WOMars.h"
+
+using namespace Aftr;
+
+constexpr size_t READBACK_BUFFERS = 3; // images read back at once, the GPU renders the next while the last transfers
+constexpr uint32_t LOCALITY_GRID = 2048; // cells along each axis of the Hilbert curve poses are ordered by
+
+// distance along a Hilbert curve filling an n by n grid (n a power of two)
+static uint64_t getHilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0 ? 1 : 0;
+        uint32_t ry = (y & s) > 0 ? 1 : 0;
+        d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant so the curve stays continuous
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+std::unique_ptr<BatchRenderer> BatchRenderer::New(GLsizei width, GLsizei height)
+{
+    std::string path = ManagerEnvironmentConfiguration::getVariableValue("marsBatchPoses");
+    if (path.empty()) {
+        return nullptr;
+    }
+
+    std::vector<BatchPose> poses;
+    if (!loadPoses(path, poses) || poses.empty()) {
+        std::cerr << "WARNING: No poses to batch render in " << path << std::endl;
+        return nullptr;
+    }
+
+    std::string outputDir = ManagerEnvironmentConfiguration::getVariableValue("marsBatchOutput");
+    if (outputDir.empty()) {
+        outputDir = BATCH_OUTPUT_DIR;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(outputDir, error);
+    if (error) {
+        std::cerr << "WARNING: Unable to create batch output directory " << outputDir << ": " << error.message() << std::endl;
+        return nullptr;
+    }
+
+    size_t numWriters = static_cast<size_t>(std::max(getConfigDouble("marsBatchWriters", std::max(std::thread::hardware_concurrency() / 2, 1u)), 1.0));
+    double poseTimeoutSec = getConfigDouble("marsBatchPoseTimeoutSec", BATCH_POSE_TIMEOUT_SEC);
+
+    std::cout << "Mars: batch rendering " << poses.size() << " poses from " << path << " into " << outputDir
+        << " at " << width << "x" << height << " on " << reinterpret_cast<const char*>(glGetString(GL_RENDERER)) << std::endl;
+
+    return std::unique_ptr<BatchRenderer>(new BatchRenderer(std::move(poses), outputDir, width, height, numWriters, poseTimeoutSec));
+}
+
+BatchRenderer::BatchRenderer(std::vector<BatchPose> poses, const std::string& outputDir, GLsizei width, GLsizei height, size_t numWriters, double poseTimeoutSec)
+    : poses(std::move(poses))
+    , outputDir(outputDir)
+    , width(width)
+    , height(height)
+    , poseTimeoutSec(poseTimeoutSec)
+    , nextPose(0)
+    , placed(false)
+    , timeouts(0)
+    , maxQueued(numWriters * 2)
+    , writing(0)
+    , written(0)
+    , writeFailures(0)
+    , stopping(false)
+{
+    sortByLocality(this->poses);
+
+    // offscreen framebuffer the poses are rendered into
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "WARNING: Batch rendering framebuffer is incomplete" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // pixel buffers the images are read back through without stalling on the transfer
+    freeBuffers.resize(READBACK_BUFFERS);
+    glGenBuffers(static_cast<GLsizei>(freeBuffers.size()), freeBuffers.data());
+    for (GLuint buffer : freeBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<size_t>(width) * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (size_t i = 0; i < numWriters; ++i) {
+        writers.emplace_back(&BatchRenderer::writeImages, this);
+    }
+}
+
+BatchRenderer::~BatchRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        stopping = true;
+    }
+    writeReady.notify_all();
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    for (auto& readback : readbacks) {
+        glDeleteSync(readback.fence);
+        freeBuffers.push_back(readback.buffer);
+    }
+    glDeleteBuffers(static_cast<GLsizei>(freeBuffers.size()), freeBuffers.data());
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+}
+
+bool BatchRenderer::loadPoses(const std::string& path, std::vector<BatchPose>& poses)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "WARNING: Unable to open pose file " << path << std::endl;
+        return false;
+    }
+
+    // one pose per line: latitude longitude elevation heading pitch, # starts a comment
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        BatchPose pose;
+        if (!(fields >> pose.loc.x >> pose.loc.y >> pose.loc.z >> pose.heading >> pose.pitch)) {
+            std::cerr << "WARNING: Invalid pose on line " << lineNumber << " of " << path << ": " << line << std::endl;
+            return false;
+        }
+        pose.index = poses.size();
+        poses.push_back(pose);
+    }
+
+    return true;
+}
+
+void BatchRenderer::sortByLocality(std::vector<BatchPose>& poses)
+{
+    // the curve covers longitude across its width and latitude across the top half of its height
+    auto key = [](const BatchPose& pose) {
+        double x = (pose.loc.y + 180.0) / 360.0 * LOCALITY_GRID;
+        double y = (90.0 - pose.loc.x) / 360.0 * LOCALITY_GRID;
+        return getHilbertIndex(LOCALITY_GRID,
+            static_cast<uint32_t>(std::clamp(x, 0.0, LOCALITY_GRID - 1.0)),
+            static_cast<uint32_t>(std::clamp(y, 0.0, LOCALITY_GRID - 1.0)));
+    };
+
+    std::vector<std::pair<uint64_t, BatchPose>> keyed;
+    keyed.reserve(poses.size());
+    for (auto& pose : poses) {
+        keyed.emplace_back(key(pose), pose);
+    }
+    std::stable_sort(keyed.begin(), keyed.end(),
+        [](const std::pair<uint64_t, BatchPose>& a, const std::pair<uint64_t, BatchPose>& b) { return a.first < b.first; });
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        poses[i] = keyed[i].second;
+    }
+}
+
+bool BatchRenderer::update(WOMars& mars, Camera& cam)
+{
+    collectReadbacks();
+
+    if (nextPose < poses.size()) {
+        if (!placed) {
+            start = std::chrono::steady_clock::now();
+            place(mars, cam, poses[nextPose]);
+            return true;
+        }
+
+        // the camera was placed at the end of an earlier update, so the terrain has been updated for it since
+        const bool complete = mars.isViewComplete();
+        const bool timedOut = poseTimeoutSec > 0.0
+            && std::chrono::duration<double>(std::chrono::steady_clock::now() - placedAt).count() > poseTimeoutSec;
+        bool queueFull;
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            queueFull = writeQueue.size() >= maxQueued;
+        }
+
+        if ((complete || timedOut) && !freeBuffers.empty() && !queueFull) {
+            if (!complete) {
+                ++timeouts;
+                std::cerr << "WARNING: Batch pose " << poses[nextPose].index << " rendered before all of its tiles loaded" << std::endl;
+            }
+
+            render(mars, cam, poses[nextPose].index);
+            if (++nextPose < poses.size()) {
+                place(mars, cam, poses[nextPose]);
+            }
+        }
+        return true;
+    }
+
+    if (!readbacks.empty()) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (!writeQueue.empty() || writing > 0) {
+            return true;
+        }
+    }
+
+    report();
+    return false;
+}
+
+void BatchRenderer::place(WOMars& mars, Camera& cam, const BatchPose& pose)
+{
+    // local frame at the pose, the step towards north is taken away from the pole
+    VectorD pos = mars.getWorldFromMars2000(pose.loc);
+    VectorD up = mars.getWorldFromMars2000(VectorD(pose.loc.x, pose.loc.y, pose.loc.z + 1.0)) - pos;
+    up.normalize();
+    const double step = pose.loc.x < 89.0 ? 0.001 : -0.001;
+    VectorD north = (mars.getWorldFromMars2000(VectorD(pose.loc.x + step, pose.loc.y, pose.loc.z)) - pos) * (step > 0.0 ? 1.0 : -1.0);
+    north = (north - up * north.dotProduct(up)).normalizeMe();
+    VectorD east = north.crossProduct(up);
+
+    const double heading = pose.heading * Aftr::DEGtoRADd;
+    const double pitch = pose.pitch * Aftr::DEGtoRADd;
+    const VectorD forward = north * std::cos(heading) + east * std::sin(heading);
+    const VectorD look = forward * std::cos(pitch) + up * std::sin(pitch);
+
+    // the camera's axes are look, left and up. Its up is tilted with the pitch, so looking straight
+    // down the top of the image faces the heading (and looking straight up the bottom does)
+    const VectorD camUp = forward * -std::sin(pitch) + up * std::cos(pitch);
+    const VectorD left = camUp.crossProduct(look);
+
+    cam.setPosition(Vector(static_cast<float>(pos.x), static_cast<float>(pos.y), static_cast<float>(pos.z)));
+    cam.getModel()->setDisplayMatrix(Mat4(look.toVecS(), left.toVecS(), camUp.toVecS()));
+
+    placed = true;
+    placedAt = std::chrono::steady_clock::now();
+}
+
+void BatchRenderer::render(WOMars& mars, const Camera& cam, size_t pose)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLfloat clearColor[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+
+    // only the terrain, through the same draw list the window renders
+    mars.getModel()->render(cam);
+
+    // returns once the read is queued, the fence signals when the pixels are in the buffer
+    Readback readback;
+    readback.pose = pose;
+    readback.buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readbacks.push_back(readback);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
+
+void BatchRenderer::collectReadbacks()
+{
+    while (!readbacks.empty()) {
+        Readback& readback = readbacks.front();
+
+        // poll without waiting, fences signal in submission order so stop at the first pending one
+        GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(readback.fence);
+
+        Image image;
+        image.pose = readback.pose;
+        image.pixels.resize(static_cast<size_t>(width) * height * 4);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const void* src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image.pixels.size(), GL_MAP_READ_BIT);
+        if (src != nullptr) {
+            std::memcpy(image.pixels.data(), src, image.pixels.size());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        } else {
+            std::cerr << "Unable to map batch readback buffer" << std::endl;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        freeBuffers.push_back(readback.buffer);
+        readbacks.pop_front();
+
+        if (src != nullptr) {
+            {
+                std::lock_guard<std::mutex> lock(writeMutex);
+                writeQueue.push_back(std::move(image));
+            }
+            writeReady.notify_one();
+        } else {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            ++writeFailures;
+        }
+    }
+}
+
+void BatchRenderer::writeImages()
+{
+    std::unique_lock<std::mutex> lock(writeMutex);
+    while (true) {
+        writeReady.wait(lock, [this]() { return stopping || !writeQueue.empty(); });
+        if (writeQueue.empty()) {
+            return; // stopping
+        }
+
+        Image image = std::move(writeQueue.front());
+        writeQueue.pop_front();
+        ++writing;
+
+        lock.unlock();
+        bool ok = writeImage(image);
+        lock.lock();
+
+        --writing;
+        if (ok) {
+            ++written;
+        } else {
+            ++writeFailures;
+        }
+    }
+}
+
+bool BatchRenderer::writeImage(const Image& image) const
+{
+    // PPM rows run top to bottom and have no alpha
+    std::vector<GLubyte> rgb(static_cast<size_t>(width) * height * 3);
+    for (GLsizei y = 0; y < height; ++y) {
+        const GLubyte* src = &image.pixels[static_cast<size_t>(height - 1 - y) * width * 4];
+        GLubyte* dst = &rgb[static_cast<size_t>(y) * width * 3];
+        for (GLsizei x = 0; x < width; ++x) {
+            dst[x * 3 + 0] = src[x * 4 + 0];
+            dst[x * 3 + 1] = src[x * 4 + 1];
+            dst[x * 3 + 2] = src[x * 4 + 2];
+        }
+    }
+
+    std::ostringstream name;
+    name << outputDir << "/pose_" << std::setw(6) << std::setfill('0') << image.pose << ".ppm";
+    std::ofstream file(name.str(), std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    if (!file) {
+        std::cerr << "WARNING: Unable to write " << name.str() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void BatchRenderer::report()
+{
+    double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Mars: batch rendered " << written << " images in " << elapsedSec << " s, "
+        << written / std::max(elapsedSec, 1e-9) << " images/sec (" << timeouts << " timed out waiting on tiles, "
+        << writeFailures << " failed to write)" << std::endl;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AftrOpenGLIncludes.h"
+#include "Vector.h"
+
+namespace Aftr {
+    class Camera;
+    class WOMars;
+
+    // a camera pose of the pose file
+    struct BatchPose {
+        size_t index; // line order in the pose file, names the image
+        VectorD loc; // mars2000 latitude, longitude and elevation in meters
+        double heading; // degrees clockwise from north
+        double pitch; // degrees above the horizon
+    };
+
+    // renders every pose of a pose file offscreen through the terrain's model once the patches around
+    // it are fully loaded, and writes the images as PPMs on a pool of writer threads. Poses are visited
+    // along a Hilbert curve so consecutive ones share most of their tiles.
+    class BatchRenderer {
+    public:
+        // null if marsBatchPoses isn't set or the pose file can't be read
+        static std::unique_ptr<BatchRenderer> New(GLsizei width, GLsizei height);
+        ~BatchRenderer();
+
+        // call once per frame after the world is updated, moves the camera to the next pose once the
+        // current one is rendered. Returns false once every image has been written.
+        bool update(WOMars& mars, Camera& cam);
+
+    protected:
+        // an image being read back from the framebuffer into a pixel buffer object
+        struct Readback {
+            size_t pose;
+            GLuint buffer;
+            GLsync fence;
+        };
+
+        struct Image {
+            size_t pose;
+            std::vector<GLubyte> pixels; // RGBA, bottom row first
+        };
+
+        std::vector<BatchPose> poses;
+        std::string outputDir;
+        GLsizei width;
+        GLsizei height;
+        double poseTimeoutSec;
+
+        GLuint fbo;
+        GLuint colorBuffer;
+        GLuint depthBuffer;
+        std::vector<GLuint> freeBuffers;
+        std::deque<Readback> readbacks; // in submission order, which is also fence signal order
+
+        size_t nextPose; // index into poses of the pose the camera is placed at
+        bool placed; // the camera is at nextPose and the world has been updated since
+        std::chrono::steady_clock::time_point placedAt;
+        std::chrono::steady_clock::time_point start;
+        size_t timeouts;
+
+        std::vector<std::thread> writers;
+        std::mutex writeMutex;
+        std::condition_variable writeReady;
+        std::condition_variable writeDone;
+        std::deque<Image> writeQueue;
+        size_t maxQueued;
+        size_t writing; // images taken off the queue but not yet written
+        size_t written;
+        size_t writeFailures;
+        bool stopping;
+
+        BatchRenderer(std::vector<BatchPose> poses, const std::string& outputDir, GLsizei width, GLsizei height, size_t numWriters, double poseTimeoutSec);
+
+        static bool loadPoses(const std::string& path, std::vector<BatchPose>& poses);
+        static void sortByLocality(std::vector<BatchPose>& poses);
+
+        void place(WOMars& mars, Camera& cam, const BatchPose& pose);
+        void render(WOMars& mars, const Camera& cam, size_t pose);
+        void collectReadbacks();
+        void writeImages();
+        bool writeImage(const Image& image) const;
+        void report();
+    };
+}
@@ -1,8 +1,44 @@
 #pragma once
 
+#include "core/MarsConstants.h"
+
 namespace Aftr {
-    constexpr GLuint PATCH_RESOLUTION = 256; // square resolution of imagery and elevation tiles from the database
+    using MarsCore::PATCH_RESOLUTION;
+    using MarsCore::PATCH_GRID_WIDTH;
+    using MarsCore::PATCH_GRID_HEIGHT;
+    using MarsCore::NUM_PATCHES;
+    using MarsCore::MARS_SEMIMAJOR_AXIS;
+    using MarsCore::MARS_RECIPROCAL_FLATTENING;
+    using MarsCore::NUM_VERTS_PER_PATCH;
+    using MarsCore::NUM_TRIS_PER_PATCH;
+
+    constexpr const char* TILE_SERVER_URL = "http://192.168.1.110:3000/"; // default Mars database serving the tiles (overridden by aftr.conf)
+    constexpr const char* TILE_ELEVATION_ENDPOINT = "elevation";
+    constexpr const char* TILE_IMAGERY_ENDPOINT = "imagery";
     constexpr double MARS_SCALE = 1e-1; // scale of planet Mars
     constexpr GLuint NUM_PATCHES_PER_BUFFER = 10; // number of patches per OpenGL buffer
-    constexpr int32_t PATCH_RENDER_RADIUS = 1; // number of patches surrounding the current patch to render (in a square, not a circle)
+    constexpr int32_t PATCH_RENDER_RADIUS = 1; // initial number of patches surrounding the current patch to render (in a square, not a circle)
+    constexpr int32_t PATCH_MIN_RENDER_RADIUS = 1; // default lower bound of the runtime render radius (overridden by aftr.conf)
+    constexpr int32_t PATCH_MAX_RENDER_RADIUS = 6; // default upper bound of the runtime render radius (overridden by aftr.conf)
+    constexpr double PATCH_MAX_LONGITUDE_WIDENING = 4.0; // most the visible set widens along longitude near the poles, where patches are narrow
+    constexpr uint32_t PATCH_MAX_DETAIL = 5; // coarsest patch detail level, each level halves the tessellation
+    constexpr double PATCH_MESH_ERROR_METERS = 2.0; // default error tolerance of the adaptive patch meshes at full detail (overridden by aftr.conf)
+    constexpr size_t MAX_RESIDENT_PATCHES = 128; // default number of patches kept in memory (overridden by aftr.conf)
+    constexpr double TARGET_FRAME_MS = 16.0; // default frame time the render radius is governed towards (overridden by aftr.conf)
+    constexpr GLuint PATCH_COARSE_RESOLUTION = 32; // default resolution of the coarse tiles shown before the full ones arrive (overridden by aftr.conf)
+    constexpr size_t TEXTURE_STREAM_SLOTS = 8; // default number of pixel buffers used to stream patch imagery (overridden by aftr.conf)
+    constexpr GLuint PATCH_TEXTURE_CHANNELS = 4; // imagery is expanded to RGBA so texture rows upload without driver swizzling
+    constexpr size_t TEXTURE_BUDGET_MB = 64; // default memory of the full patch textures before fine levels are dropped (overridden by aftr.conf)
+    constexpr double VIEW_FIELD_OF_VIEW_DEG = 60.0; // default vertical field of view used to project patch sizes (overridden by aftr.conf)
+    constexpr double VIEW_HEIGHT_PIXELS = 1080.0; // viewport height used to project patch sizes when the window height isn't set
+    constexpr const char* SHARED_TILE_CACHE_NAME = "MarsVisualizationTiles"; // shared memory segment of the multi-process tile cache
+    constexpr uint32_t SHARED_TILE_CACHE_TILES = 1024; // default number of tiles in the shared tile cache (overridden by aftr.conf)
+    constexpr size_t MAX_REQUESTS_IN_FLIGHT = 16; // default limit of concurrent tile requests per tile server (overridden by aftr.conf)
+    constexpr uint32_t TILE_MAX_RETRIES = 3; // default retries of a failed tile request (overridden by aftr.conf)
+    constexpr double TILE_RETRY_BACKOFF_MS = 100.0; // default delay before the first retry of a tile request (overridden by aftr.conf)
+    constexpr double TILE_NEGATIVE_CACHE_SEC = 30.0; // default time a tile that failed every retry isn't requested again (overridden by aftr.conf)
+    constexpr double PATCH_UPLOAD_BUDGET_MS = 4.0; // default per-frame time budget for integrating loaded patches (overridden by aftr.conf)
+    constexpr size_t PATCH_UPLOAD_BUDGET_BYTES = 8 * 1024 * 1024; // default per-frame upload budget in bytes (overridden by aftr.conf)
+    constexpr const char* BATCH_OUTPUT_DIR = "batch"; // default directory of the batch rendered images (overridden by aftr.conf)
+    constexpr double BATCH_POSE_TIMEOUT_SEC = 60.0; // default time a batch pose waits on its tiles before it is rendered anyway (overridden by aftr.conf)
 };
\ No newline at end of file
@@ -6,10 +6,6 @@
 #include "Constants.h"
 
 namespace Aftr {
-    // derived constants
-    constexpr GLuint NUM_VERTS_PER_PATCH = PATCH_RESOLUTION * PATCH_RESOLUTION;
-    constexpr GLuint NUM_TRIS_PER_PATCH = (PATCH_RESOLUTION - 1) * (PATCH_RESOLUTION - 1) * 2;
-
     struct GLVertex {
         Vector pos;
         Vector norm;
@@ -113,5 +109,18 @@ namespace Aftr {
             glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, baseIndexByte, numBytes, indexData + baseIndex);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         }
+
+        void uploadPatchIndices(GLuint index, GLuint count)
+        {
+            assert(index < size);
+            assert(count <= NUM_TRIS_PER_PATCH * 3);
+
+            const GLuint baseIndex = index * NUM_TRIS_PER_PATCH * 3;
+            const GLuint baseIndexByte = baseIndex * sizeof(GLuint);
+            const GLuint numBytes = count * sizeof(GLuint);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, baseIndexByte, numBytes, indexData + baseIndex);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        }
     };
 };
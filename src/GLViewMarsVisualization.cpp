@@ -5,6 +5,7 @@
 #include "WorldList.h"
 
 #include "AftrGLRendererBase.h"
+#include "BatchRenderer.h"
 #include "Camera.h"
 #include "Constants.h"
 #include "Model.h"
@@ -46,6 +47,11 @@ void GLViewMarsVisualization::onCreate()
     }
     this->setActorChaseType( STANDARDEZNAV ); //Default is STANDARDEZNAV mode
     //this->setNumPhysicsStepsPerRender( 0 ); //pause physics engine on start up; will remain paused till set to 1
+
+    //batch mode renders at the window's size so the camera's projection matches
+    GLint viewport[4];
+    glGetIntegerv( GL_VIEWPORT, viewport );
+    this->batch = BatchRenderer::New( viewport[2], viewport[3] );
 }
 
 GLViewMarsVisualization::~GLViewMarsVisualization()
@@ -56,6 +62,15 @@ GLViewMarsVisualization::~GLViewMarsVisualization()
 void GLViewMarsVisualization::updateWorld()
 {
     GLView::updateWorld(); //Just call the parent's update world.
+
+    if( this->batch != nullptr && !this->batch->update( *this->mars, *this->cam ) )
+    {
+        //every image is written, exit like closing the window does
+        this->batch = nullptr;
+        SDL_Event quit;
+        quit.type = SDL_QUIT;
+        SDL_PushEvent( &quit );
+    }
 }
 
 void Aftr::GLViewMarsVisualization::loadMap()
@@ -122,7 +137,7 @@ void Aftr::GLViewMarsVisualization::loadMap()
     //VectorD loc(-8.88, -92.27, 2);
     VectorD loc(-6.93, -87.26, 2);
 
-    WOMars* mars = WOMars::New(const_cast<const Camera**>(getCameraPtrPtr()), loc, MARS_SCALE);
+    mars = WOMars::New(const_cast<const Camera**>(getCameraPtrPtr()), loc, MARS_SCALE);
     mars->setPosition(0, 0, 0);
     worldLst->push_back(mars);
 }
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <memory>
+
 #include "GLView.h"
 
 namespace Aftr {
+    class BatchRenderer;
     class Camera;
+    class WOMars;
 
     class GLViewMarsVisualization : public GLView {
     public:
@@ -21,5 +25,8 @@ namespace Aftr {
     protected:
        GLViewMarsVisualization( const std::vector< std::string >& args );
        virtual void onCreate();   
+
+       WOMars* mars = nullptr;
+       std::unique_ptr< BatchRenderer > batch; ///< renders the poses of marsBatchPoses offscreen, null when running interactively
     };
 }
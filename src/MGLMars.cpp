@@ -1,32 +1,68 @@
 #include "MGLMars.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <random>
+#include <sstream>
 #include <string>
 
 #include "Camera.h"
 #include "GLSLShaderDefaultGL32.h"
+#include "ManagerEnvironmentConfiguration.h"
 #include "Utils.h"
+#include "core/AdaptiveMesh.h"
+#include "core/ImageMips.h"
+#include "core/Mars2000.h"
+#include "core/PatchMesh.h"
+#include "core/TileDecode.h"
 
 using namespace Aftr;
 
+constexpr uint32_t COARSE_FAILURE_LIMIT = 8; // consecutive coarse tile failures before progressive loading is disabled
+
+// moves a cartesian position relative to the center of Mars into the reference frame
+static VectorD toReferenceFrame(const MarsCore::Vec3d& cart, const Mat4D& refInv)
+{
+    double in[4] = { cart.x, cart.y, cart.z, 1.0 };
+    double out[4];
+    transformVector4DThrough4x4Matrix(in, out, refInv.getPtr());
+
+    return VectorD(out[0], out[1], out[2]);
+}
+
+// memory of the mip levels from level down to the coarsest of a full imagery texture
+static size_t getTextureBytes(GLuint level)
+{
+    const GLuint numLevels = MarsCore::getNumMipLevels(PATCH_RESOLUTION);
+    return MarsCore::getMipOffset(PATCH_RESOLUTION, numLevels, PATCH_TEXTURE_CHANNELS) - MarsCore::getMipOffset(PATCH_RESOLUTION, level, PATCH_TEXTURE_CHANNELS);
+}
+
 MGLMars::MGLMars(WO* parentWO, double scale, const Mat4D& refMat)
     : MGL(parentWO)
-    , asyncPatchesToLoad(std::thread::hardware_concurrency())
+    , asyncPatchesLoaded(std::thread::hardware_concurrency())
+    , patches(NUM_PATCHES)
+    , residentTextureBytes(0)
 {
     marsScale = scale;
     reference = refMat;
     Aftr::aftrGluInvertMatrix(reference.getPtr(), referenceInv.getPtr());
+    terrainQuery = std::make_shared<TerrainQuery>(scale);
 
     init();
 }
 
 MGLMars::~MGLMars()
 {
-    shutdownMsg.store(true);
-
-    // join background threads in
-    for (size_t i = 0; i < asyncThreads.size(); i++) {
-        asyncThreads[i].join();
+    // cancel outstanding requests and stop the decode threads before the patches go away
+    tileLoader->shutdown();
+    if (framePlanWork.valid()) {
+        framePlanWork.wait();
+    }
+    for (auto& view : views) {
+        if (view->nextVisibleWork.valid()) {
+            view->nextVisibleWork.wait();
+        }
     }
 }
 
@@ -64,33 +100,196 @@ void MGLMars::init()
 
     glBindVertexArray(0);
 
-    shutdownMsg.store(false); // ensure shutdown message is not true
-
-    // spawn background threads that handle async elevation + imagery fetching
-    for (size_t i = 0; i < std::max(std::thread::hardware_concurrency(), 1u); ++i) {
-        asyncThreads.emplace_back([this, i]() {
-            std::default_random_engine gen;
-            gen.seed(static_cast<unsigned int>(i));
-            std::uniform_int_distribution<unsigned int> dist(3, 10);
-
-            while (!shutdownMsg.load()) {
-                Patch* patch;
-                if (asyncPatchesToLoad.pop(patch)) {
-                    bool success = loadElevation(patch->id, patch->elevData);
-                    if (success) {
-                        patch->elevReady.store(true);
-                    }
-
-                    success = loadImagery(patch->id, patch->imgData);
-                    if (success) {
-                        patch->imgReady.store(true);
-                    }
-                } else {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(dist(gen)));
-                }
+    // per-frame budget for integrating loaded patches
+    uploadBudgetMs = getConfigDouble("marsUploadBudgetMs", PATCH_UPLOAD_BUDGET_MS);
+    uploadBudgetBytes = static_cast<size_t>(std::max(getConfigDouble("marsUploadBudgetBytes", static_cast<double>(PATCH_UPLOAD_BUDGET_BYTES)), 0.0));
+
+    // pixel buffers for streaming imagery into textures
+    size_t streamSlots = static_cast<size_t>(std::max(getConfigDouble("marsTextureStreamSlots", static_cast<double>(TEXTURE_STREAM_SLOTS)), 1.0));
+    textureStreamer = std::make_unique<TextureStreamer>(streamSlots, getTextureBytes(0));
+
+    // full textures stream in the mip levels their projected size needs, within a memory budget
+    textureBudgetBytes = static_cast<size_t>(std::max(getConfigDouble("marsTextureBudgetMB", static_cast<double>(TEXTURE_BUDGET_MB)), 0.0) * 1024.0 * 1024.0);
+    double viewHeight = getConfigDouble("height", 0.0);
+    if (viewHeight <= 0.0) {
+        viewHeight = VIEW_HEIGHT_PIXELS; // matches the desktop resolution, which isn't known here
+    }
+    double fieldOfView = std::clamp(getConfigDouble("marsFieldOfViewDeg", VIEW_FIELD_OF_VIEW_DEG), 1.0, 179.0);
+    pixelsPerRadian = viewHeight / (fieldOfView * Aftr::DEGtoRADd);
+
+#ifdef AFTR_CONFIG_USE_ODE
+    // heightfields for colliding physics bodies against the resident terrain
+    if (getConfigDouble("marsTerrainCollision", 1.0) != 0.0) {
+        terrainCollider = std::make_shared<TerrainCollider>(marsScale);
+    }
+#endif
+
+    // optionally print how long views take to fill and how much the adaptive meshes save
+    loadMetricsEnabled = getConfigDouble("marsLoadMetrics", 0.0) != 0.0;
+
+    // optionally measure the terrain query throughput once the view is loaded
+    queryBenchmarkEnabled = getConfigDouble("marsQueryBenchmark", 0.0) != 0.0;
+
+    // the first view, more can be added for other cameras
+    addView();
+    lastUpdate = std::chrono::steady_clock::now();
+
+    // progressive loading shows coarse tiles until the full ones arrive
+    coarseResolution = static_cast<GLuint>(std::max(getConfigDouble("marsCoarseResolution", PATCH_COARSE_RESOLUTION), 0.0));
+    if (coarseResolution >= PATCH_RESOLUTION || coarseResolution == 1) {
+        coarseResolution = 0;
+    }
+    coarseFailures.store(0);
+
+    // adaptive meshes replace the uniform grid once the full elevation arrives
+    meshError = static_cast<float>(getConfigDouble("marsMeshErrorMeters", PATCH_MESH_ERROR_METERS));
+    meshTriangles.store(0);
+    meshPatches.store(0);
+
+    // requests in flight are bounded by each server, not by the core count
+    size_t maxRequests = static_cast<size_t>(std::max(getConfigDouble("marsMaxRequestsInFlight", static_cast<double>(MAX_REQUESTS_IN_FLIGHT)), 2.0));
+    size_t decodeThreads = static_cast<size_t>(std::max(getConfigDouble("marsDecodeThreads", std::max(std::thread::hardware_concurrency() / 2, 1u)), 1.0));
+
+    // co-located instances can share the fetched tiles instead of each downloading their own
+    std::shared_ptr<SharedTileCache> tileCache;
+    if (getConfigDouble("marsSharedTileCache", 0.0) != 0.0) {
+        uint32_t numTiles = static_cast<uint32_t>(std::max(getConfigDouble("marsSharedTileCacheTiles", SHARED_TILE_CACHE_TILES), 1.0));
+        size_t tileSize = std::max(MarsCore::getElevationTileSize(PATCH_RESOLUTION), MarsCore::getImageryTileSize(PATCH_RESOLUTION));
+        tileCache = SharedTileCache::open(SHARED_TILE_CACHE_NAME, numTiles, tileSize);
+        if (tileCache != nullptr) {
+            std::cout << "Mars: shared tile cache " << SHARED_TILE_CACHE_NAME << " mapped with room for " << numTiles << " tiles" << std::endl;
+        }
+    }
+
+    // tile servers requests are balanced across, separated by commas or spaces
+    std::vector<std::string> tileServers;
+    std::istringstream serverList(ManagerEnvironmentConfiguration::getVariableValue("marsTileServers"));
+    std::string server;
+    while (std::getline(serverList, server, ',')) {
+        std::istringstream words(server);
+        while (words >> server) {
+            tileServers.push_back(server);
+        }
+    }
+    if (tileServers.empty()) {
+        tileServers.push_back(TILE_SERVER_URL);
+    }
+    std::cout << "Mars: loading tiles from " << tileServers.size() << " tile server" << (tileServers.size() > 1 ? "s" : "") << std::endl;
+
+    TileLoader::RetryPolicy retryPolicy;
+    retryPolicy.maxRetries = static_cast<uint32_t>(std::max(getConfigDouble("marsTileRetries", TILE_MAX_RETRIES), 0.0));
+    retryPolicy.backoffMs = std::max(getConfigDouble("marsTileRetryBackoffMs", TILE_RETRY_BACKOFF_MS), 1.0);
+    retryPolicy.negativeCacheSec = getConfigDouble("marsTileNegativeCacheSec", TILE_NEGATIVE_CACHE_SEC);
+
+    tileLoader = std::make_unique<TileLoader>(tileServers, maxRequests, decodeThreads, retryPolicy, tileCache);
+}
+
+void MGLMars::pumpLoads()
+{
+    std::lock_guard<std::mutex> lock(loadMutex);
+
+    // each patch load issues an elevation and an imagery request
+    while (tileLoader->hasCapacity(2)) {
+        Patch* patch = nullptr;
+        bool coarse = false;
+        if (!coarseLoadQueue.empty()) {
+            // every queued patch gets coarse data before any is refined
+            patch = coarseLoadQueue.front();
+            coarseLoadQueue.pop_front();
+            coarse = true;
+        } else if (!refineLoadQueue.empty()) {
+            // refine the patch closest to the camera first
+            auto next = std::min_element(refineLoadQueue.begin(), refineLoadQueue.end(),
+                [](const Patch* a, const Patch* b) { return a->loadPriority.load() < b->loadPriority.load(); });
+            patch = *next;
+            *next = refineLoadQueue.back();
+            refineLoadQueue.pop_back();
+        } else {
+            break;
+        }
+
+        startLoad(patch, coarse);
+    }
+}
+
+void MGLMars::startLoad(Patch* patch, bool coarse)
+{
+    // called with loadMutex held, the callbacks run later on the decode threads
+    auto requestsLeft = std::make_shared<std::atomic<int>>(2);
+    auto finish = [this, patch, coarse, requestsLeft]() {
+        if (requestsLeft->fetch_sub(1) != 1) {
+            return;
+        }
+
+        if (coarse) {
+            // queue the refinement
+            std::lock_guard<std::mutex> lock(loadMutex);
+            refineLoadQueue.push_back(patch);
+        } else {
+            // the patch may be evicted from here on, so it must not be touched again
+            patch->loadDone.store(true);
+        }
+
+        pumpLoads();
+    };
+
+    const GLuint resolution = coarse ? coarseResolution : PATCH_RESOLUTION;
+
+    tileLoader->fetch(TILE_ELEVATION_ENDPOINT, patch->id, resolution, [this, patch, coarse, resolution, finish](const unsigned char* body, size_t size) {
+        if (coarse) {
+            std::vector<int16_t> elev;
+            if (body != nullptr && decodeElevation(patch->id, body, size, resolution, elev)) {
+                resampleElevation(elev, resolution, patch->coarseElevData, PATCH_RESOLUTION);
+                generateElevatedPositions(patch->id, patch->coarseElevData, marsScale, referenceInv, patch->coarseElevPositions);
+                terrainQuery->addPatch(std::make_shared<PatchHeightField>(patch->id, patch->coarseElevData, true));
+                patch->coarseElevReady.store(true);
+                asyncPatchesLoaded.push(patch->id);
+                coarseFailures.store(0);
+            } else if (coarseFailures.fetch_add(1) + 1 == COARSE_FAILURE_LIMIT) {
+                std::cerr << "WARNING: Coarse tiles keep failing to load, disabling progressive loading." << std::endl;
             }
-        });
+        } else if (body != nullptr && decodeElevation(patch->id, body, size, resolution, patch->elevData)) {
+            buildPatchMesh(*patch);
+            generateElevatedPositions(patch->id, patch->elevData, marsScale, referenceInv, patch->elevPositions);
+            auto field = std::make_shared<PatchHeightField>(patch->id, patch->elevData);
+            terrainQuery->addPatch(field);
+#ifdef AFTR_CONFIG_USE_ODE
+            if (terrainCollider != nullptr) {
+                terrainCollider->addPatch(TerrainCollider::buildShape(*field, marsScale));
+            }
+#endif
+            patch->elevReady.store(true);
+            asyncPatchesLoaded.push(patch->id);
+        }
+
+        finish();
+    });
+
+    tileLoader->fetch(TILE_IMAGERY_ENDPOINT, patch->id, resolution, [this, patch, coarse, resolution, finish](const unsigned char* body, size_t size) {
+        std::vector<GLubyte>& data = coarse ? patch->coarseImgData : patch->imgData;
+        if (body != nullptr && decodeImagery(patch->id, body, size, resolution, data, PATCH_TEXTURE_CHANNELS)) {
+            // the coarser levels must exist before the finest one is uploaded, so they're built here
+            MarsCore::buildMipChain(data, resolution, PATCH_TEXTURE_CHANNELS);
+            (coarse ? patch->coarseImgReady : patch->imgReady).store(true);
+            asyncPatchesLoaded.push(patch->id);
+        }
+
+        finish();
+    });
+}
+
+void MGLMars::buildPatchMesh(Patch& patch)
+{
+    if (meshError <= 0.0f) {
+        return;
     }
+
+    // only the vertex errors are kept (about 260 KB), index lists of every detail level would take
+    // several times that for each resident patch
+    patch.mesh = std::make_unique<MarsCore::AdaptiveMesh>(patch.elevData);
+
+    meshTriangles += patch.mesh->countTriangles(meshError);
+    meshPatches++;
 }
 
 void MGLMars::render(const Camera& cam)
@@ -108,10 +307,11 @@ void MGLMars::render(const Camera& cam)
     // activate relevant texture unit
     glActiveTexture(GL_TEXTURE0);
 
+    // the list only decides which patches are drawn, their texture and index count are as of now
     std::shared_ptr<PatchArray> array = nullptr;
-    for (auto& patch : visiblePatches) {
-        if (array != patchArrays.at(patch->arrayGroup)) {
-            array = patchArrays.at(patch->arrayGroup);
+    for (auto& patch : getView(cam).drawList) {
+        if (array != patchArrays[patch->arrayGroup]) {
+            array = patchArrays[patch->arrayGroup];
 
             // bind buffer for rendering
             glBindVertexBuffer(0, array->vertexBuffer, 0, sizeof(GLVertex));
@@ -121,7 +321,6 @@ void MGLMars::render(const Camera& cam)
         }
 
         // bind texture
-
         if (patch->texture != nullptr) {
             patch->texture->bind();
         } else {
@@ -129,66 +328,469 @@ void MGLMars::render(const Camera& cam)
         }
 
         // draw
-        glDrawElements(GL_TRIANGLES, NUM_TRIS_PER_PATCH * 3, GL_UNSIGNED_INT, (GLvoid*)(patch->arrayIndex * NUM_TRIS_PER_PATCH * 3 * sizeof(GLuint)));
+        glDrawElements(GL_TRIANGLES, patch->indexCount, GL_UNSIGNED_INT, reinterpret_cast<const GLvoid*>(patch->arrayIndex * NUM_TRIS_PER_PATCH * 3 * sizeof(GLuint)));
     }
 }
 
 void MGLMars::renderSelection(const Camera& cam, GLubyte red, GLubyte green, GLubyte blue)
 {
-    for (auto& patch : visiblePatches) {
-        //patch->renderSelection(cam, red, green, blue);
+    // the terrain isn't drawn into the selection buffer, points on it are picked with WOMars::pick
+}
+
+void MGLMars::update(const std::vector<const Camera*>& cameras)
+{
+    // what the frame worker worked out while the last frame rendered
+    applyFramePlan();
+    if (evictionDue) {
+        evictPatches();
+    }
+
+    // keep the terrain queries in sync with where the model is placed
+    Mat4D modelInv;
+    aftrGluInvertMatrix(getModelMatrix().toMatD().getPtr(), modelInv.getPtr());
+    terrainQuery->setWorldTransform(reference * modelInv, getModelMatrix().toMatD() * referenceInv);
+#ifdef AFTR_CONFIG_USE_ODE
+    if (terrainCollider != nullptr) {
+        terrainCollider->update(getModelMatrix().toMatD() * referenceInv);
+    }
+#endif
+
+    const auto now = std::chrono::steady_clock::now();
+    double frameMs = std::chrono::duration<double, std::milli>(now - lastUpdate).count();
+    lastUpdate = now;
+
+    for (size_t i = 0; i < views.size() && i < cameras.size(); ++i) {
+        if (cameras[i] != nullptr) {
+            updateView(*views[i], *cameras[i], frameMs);
+        }
+    }
+
+    // start requests for newly queued patches, completions keep the pipeline full on their own
+    pumpLoads();
+
+    swapInPatchTextures();
+    dropTextureLevels();
+
+    // queue visible patches whose data arrived since the last frame
+    uint32_t loadedIndex;
+    while (asyncPatchesLoaded.pop(loadedIndex)) {
+        std::shared_ptr<Patch>& loaded = patches.at(loadedIndex);
+        if (loaded != nullptr && loaded->visible && !loaded->pending && needsIntegration(*loaded)) {
+            loaded->pending = true;
+            pendingPatches.push_back(loaded);
+        }
     }
+
+    integratePendingPatches();
+
+    // the next frame's draw lists and texture levels are worked out while this one renders
+    startFramePlan();
 }
 
-void MGLMars::update(const Camera& cam)
+void MGLMars::updateView(PatchView& view, const Camera& cam, double frameMs)
 {
     // calculate current tile from camera position
     VectorD v = getRelativeToCenter(cam.getPosition());
     VectorD camMars2000 = toMars2000FromCartesian(v, marsScale);
     uint32_t patchIndex = getPatchIndexFromMars2000(camMars2000);
-    uint32_t patchX = patchIndex % 360;
-    uint32_t patchY = patchIndex / 360;
-
-    visiblePatches.clear(); // clear visible patches, we must recalculate them
-
-    // add patches going outward from the center patch
-    for (int32_t r = 0; r <= PATCH_RENDER_RADIUS; ++r) {
-        for (int32_t y = -r; y <= r; ++y) {
-            for (int32_t x = -r; x <= r; ++x) {
-                if ((y == -r || y == r) || (x == -r || x == r)) {
-                    // get patch index
-                    uint32_t index = getNeighborPatchIndex(patchX, patchY, x, y);
-                    std::shared_ptr<Patch> patch = createUpdateGetPatch(index);
-                    visiblePatches.insert(patch);
-                }
+    if (v.x != view.camPos.x || v.y != view.camPos.y || v.z != view.camPos.z) {
+        view.complete = false; // the last frame plan was for another position
+    }
+    view.camera = &cam;
+    view.camPos = v;
+
+    // let the governor adjust the render radius to the frame time, memory use and altitude
+    view.governor.update(frameMs, patchIndex, camMars2000.z / marsScale);
+    int32_t radius = view.governor.getRadius();
+
+    // the visible set only changes when the camera crosses into another patch or the radius changes,
+    // the next one is prepared on a worker while the current one keeps rendering
+    if (view.nextVisibleWork.valid()) {
+        if (view.nextVisibleWork.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            view.nextVisibleWork.get();
+            if (!view.nextListed) {
+                generateVisiblePatches(view);
+            } else {
+                applyVisiblePatches(view);
             }
         }
+    } else if (patchIndex != view.visibleCenter || radius != view.visibleRadius) {
+        prepareVisiblePatches(view, patchIndex, radius);
     }
 }
 
-uint32_t MGLMars::getNeighborPatchIndex(uint32_t x, uint32_t y, int32_t dx, int32_t dy)
+void MGLMars::reportVisibleFilled(PatchView& view)
 {
-    uint32_t patchX;
-    if (dx < 0 && static_cast<uint32_t>(-dx) > x) { // underflow
-        uint32_t wrap = static_cast<uint32_t>(-dx) - x;
-        patchX = 360 - wrap;
-    } else if (dx > 0 && static_cast<uint32_t>(dx) > (360 - x - 1)) { // overflow
-        uint32_t wrap = static_cast<uint32_t>(dx) - (360 - x);
-        patchX = wrap;
-    } else {
-        patchX = x + dx;
+    view.visibleFilled = true;
+
+    if (loadMetricsEnabled) {
+        // time to first pixel of real data across the whole view after a move
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - view.visibleSince).count();
+        std::cout << "Mars: all " << view.visiblePatches.size() << " visible patches have data after " << elapsedMs << " ms";
+        if (views.size() > 1) {
+            std::cout << " in view " << (std::find_if(views.begin(), views.end(),
+                [&view](const std::unique_ptr<PatchView>& other) { return other.get() == &view; }) - views.begin());
+        }
+        std::cout << std::endl;
+
+        if (meshPatches.load() > 0) {
+            // triangle reduction of the adaptive meshes against the uniform grid, at full detail
+            double fraction = static_cast<double>(meshTriangles.load()) / (static_cast<double>(meshPatches.load()) * NUM_TRIS_PER_PATCH);
+            std::cout << "Mars: adaptive meshes of " << meshPatches.load() << " patches use " << fraction * 100.0
+                << "% of the uniform grid's triangles at " << meshError << " m error" << std::endl;
+        }
     }
 
-    uint32_t patchY;
-    if (dy < 0 && static_cast<uint32_t>(-dy) > y) { // underflow
-        patchY = 0;
-    } else if (dy > 0 && static_cast<uint32_t>(dy) > (360 - y - 1)) { // overflow
-        patchY = 360 - 1;
-    } else {
-        patchY = y + dy;
+    if (queryBenchmarkEnabled && !queryBenchmark.valid()) {
+        runQueryBenchmark(patches.at(view.visibleCenter)->center);
+    }
+}
+
+void MGLMars::runQueryBenchmark(const VectorD& origin)
+{
+    // start the rays a few kilometers above the center of the view
+    double in[4] = { origin.x * 1.01, origin.y * 1.01, origin.z * 1.01, 1.0 };
+    double out[4];
+    transformVector4DThrough4x4Matrix(in, out, (getModelMatrix().toMatD() * referenceInv).getPtr());
+    const VectorD rayOrigin(out[0], out[1], out[2]);
+    const double maxDistance = origin.magnitude() * 0.1;
+
+    queryBenchmark = std::async(std::launch::async, [query = terrainQuery, rayOrigin, maxDistance]() {
+        constexpr size_t NUM_QUERIES = 1000000;
+        constexpr size_t NUM_RAYS = 100000;
+
+        std::default_random_engine gen(42);
+        std::vector<uint32_t> ids = query->getPatchIds();
+        if (ids.empty()) {
+            return;
+        }
+
+        // height queries at random points of the resident patches
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::vector<VectorD> points(NUM_QUERIES);
+        for (auto& p : points) {
+            VectorD ul = getMars2000FromPatchIndex(ids[gen() % ids.size()]);
+            p = VectorD(ul.x - unit(gen), ul.y + unit(gen), 0.0);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t resident = 0;
+        for (auto& p : points) {
+            double h;
+            resident += query->heightAt(p.x, p.y, h) ? 1 : 0;
+        }
+        double heightSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // batched rays fanning down from above the view
+        std::uniform_real_distribution<double> spread(-1.0, 1.0);
+        std::vector<TerrainRay> rays(NUM_RAYS);
+        for (auto& ray : rays) {
+            ray.origin = rayOrigin;
+            ray.direction = VectorD(spread(gen), spread(gen), -1.0);
+            ray.maxDistance = maxDistance;
+        }
+
+        std::vector<TerrainHit> hits;
+        start = std::chrono::steady_clock::now();
+        query->raycast(rays, hits);
+        double raySec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t numHits = std::count_if(hits.begin(), hits.end(), [](const TerrainHit& hit) { return hit.hit; });
+
+        std::cout << "Mars: terrain query benchmark over " << ids.size() << " patches"
+            << "\n\theightAt: " << NUM_QUERIES / heightSec << " queries/sec (" << resident << " resident)"
+            << "\n\traycast: " << NUM_RAYS / raySec << " rays/sec (" << numHits << " hits)" << std::endl;
+    });
+}
+
+void MGLMars::prepareVisiblePatches(PatchView& view, uint32_t center, int32_t radius)
+{
+    view.nextCenter = center;
+    view.nextRadius = radius;
+    view.nextListed = false;
+
+    // the set is a few hundred patches towards the poles, it's listed on the worker too
+    view.nextVisibleWork = std::async(std::launch::async, [&rings = view.nextVisible, center, radius]() {
+        MarsCore::getPatchRings(center, radius, PATCH_MAX_LONGITUDE_WIDENING, rings);
+    });
+}
+
+void MGLMars::generateVisiblePatches(PatchView& view)
+{
+    view.nextListed = true;
+    view.nextGenerated.clear();
+    view.nextPatches.clear();
+
+    // patches entering the set get their slots and start loading now, their vertices are generated on the worker
+    std::vector<std::pair<uint32_t, GLVertex*>> newPatches;
+    for (auto& entry : view.nextVisible) {
+        // patches another view already created are shared
+        std::shared_ptr<Patch>& patch = patches.at(entry.first);
+        if (patch == nullptr) {
+            patch = generatePatch(entry.first);
+            newPatches.emplace_back(entry.first, patchArrays[patch->arrayGroup]->getPatchVertexStart(patch->arrayIndex));
+
+            // nothing reads the new slots until the worker is done (other views may show the patches sooner,
+            // but don't upload them), and nothing is evicted while a set is being prepared
+            patch->generating = true;
+            view.nextGenerated.push_back(entry.first);
+        }
+        view.nextPatches.push_back(patch);
+    }
+
+    view.nextVisibleWork = std::async(std::launch::async, [&next = view.nextPatches, newPatches = std::move(newPatches), scale = marsScale, refInv = referenceInv]() {
+        for (auto& newPatch : newPatches) {
+            generatePatchVertices(newPatch.first, scale, refInv, newPatch.second);
+        }
+
+        // sort by buffer so render binds each patch array once
+        std::sort(next.begin(), next.end(), [](const std::shared_ptr<Patch>& a, const std::shared_ptr<Patch>& b) {
+            return a->arrayGroup != b->arrayGroup ? a->arrayGroup < b->arrayGroup : a->arrayIndex < b->arrayIndex;
+        });
+    });
+}
+
+void MGLMars::applyVisiblePatches(PatchView& view)
+{
+    for (uint32_t index : view.nextGenerated) {
+        patches.at(index)->generating = false;
+    }
+    view.nextGenerated.clear();
+
+    view.visibleRings.swap(view.nextVisible);
+    view.nextVisible.clear();
+    view.visiblePatches.swap(view.nextPatches);
+    view.nextPatches.clear();
+
+    if (view.nextCenter != view.visibleCenter) {
+        view.visibleSince = std::chrono::steady_clock::now();
+        view.visibleFilled = false;
+    }
+
+    view.visibleCenter = view.nextCenter;
+    view.visibleRadius = view.nextRadius;
+    view.complete = false;
+
+    mergeViews();
+
+    // the draw list being rendered still shows the patches that left, until the next frame plan replaces it
+    evictionDue = true;
+}
+
+void MGLMars::mergeViews()
+{
+    for (auto& patch : visibleUnion) {
+        patch->visible = false;
+        patch->loadPriority.store(std::numeric_limits<int32_t>::max());
+        patch->textureTargetLevel = MarsCore::getNumMipLevels(PATCH_RESOLUTION) - 1; // its fine levels may be dropped
+    }
+    visibleUnion.clear();
+
+    // a patch seen by several views gets the finest detail and the highest load priority of any of them
+    for (auto& view : views) {
+        for (auto& entry : view->visibleRings) {
+            std::shared_ptr<Patch>& patch = patches.at(entry.first);
+            const uint32_t detail = view->governor.getRingDetail(entry.second);
+            if (!patch->visible) {
+                patch->visible = true;
+                patch->targetDetail = detail;
+                visibleUnion.push_back(patch);
+            } else {
+                patch->targetDetail = std::min(patch->targetDetail, detail);
+            }
+            if (entry.second < patch->loadPriority.load()) {
+                patch->loadPriority.store(entry.second);
+            }
+        }
+    }
+
+    // rebuild the integration queue from the new visible sets
+    for (auto& patch : pendingPatches) {
+        patch->pending = false;
+    }
+    pendingPatches.clear();
+
+    for (auto& patch : visibleUnion) {
+        if (needsIntegration(*patch)) {
+            patch->pending = true;
+            pendingPatches.push_back(patch);
+        }
+    }
+}
+
+void MGLMars::evictPatches()
+{
+    // sets being prepared reference patches outside the visible ones
+    for (auto& view : views) {
+        if (view->nextVisibleWork.valid()) {
+            return;
+        }
+    }
+    evictionDue = false;
+
+    // all views share the memory budget, their governors keep each visible set within a share of it
+    const size_t maxResident = views.front()->governor.getMaxResidentPatches();
+    if (residentPatches.size() <= maxResident) {
+        return;
+    }
+
+    // evict the patches farthest from every view first
+    std::vector<double> distances(NUM_PATCHES);
+    for (uint32_t index : residentPatches) {
+        distances[index] = getViewDistance(patches[index]->center);
+    }
+    std::sort(residentPatches.begin(), residentPatches.end(), [&distances](uint32_t a, uint32_t b) {
+        return distances[a] > distances[b];
+    });
+
+    size_t excess = residentPatches.size() - maxResident;
+    std::vector<uint32_t> kept;
+    kept.reserve(maxResident);
+    for (uint32_t index : residentPatches) {
+        std::shared_ptr<Patch>& patch = patches[index];
+
+        // patches still being loaded are referenced by the loader threads
+        if (excess > 0 && !patch->visible && patch->loadDone.load()) {
+            if (patch->texID != 0) {
+                residentTextureBytes -= getTextureBytes(patch->textureLevel);
+            }
+            delete patch->texture;
+            patch->texture = nullptr;
+            freeSlots.emplace_back(patch->arrayGroup, patch->arrayIndex);
+            terrainQuery->removePatch(index);
+#ifdef AFTR_CONFIG_USE_ODE
+            if (terrainCollider != nullptr) {
+                terrainCollider->removePatch(index);
+            }
+#endif
+            patch = nullptr;
+            --excess;
+        } else {
+            kept.push_back(index);
+        }
+    }
+
+    residentPatches.swap(kept);
+}
+
+void MGLMars::startFramePlan()
+{
+    // update doesn't run again until the plan is applied, and render only reads the patches
+    framePlanWork = std::async(std::launch::async, [this]() { return planFrame(); });
+}
+
+MGLMars::FramePlan MGLMars::planFrame()
+{
+    FramePlan plan;
+
+    // the view a patch is closest to decides its texture level
+    for (auto& patch : visibleUnion) {
+        const GLuint level = getTextureTargetLevel(getViewDistance(patch->center));
+        if (level != patch->textureTargetLevel) {
+            plan.textureTargets.emplace_back(patch, level);
+        }
+    }
+
+    for (auto& view : views) {
+        // the set is rebuilt on the next update if the camera moved to another patch or the radius changed
+        bool complete = view->camera != nullptr && !view->nextVisibleWork.valid() && plan.textureTargets.empty()
+            && getPatchIndexFromMars2000(toMars2000FromCartesian(view->camPos, marsScale)) == view->visibleCenter
+            && view->visibleRadius == view->governor.getRadius();
+        bool filled = true;
+
+        view->nextDrawList.clear();
+        for (auto& patch : view->visiblePatches) {
+            if (patch->geometryUploaded) {
+                view->nextDrawList.push_back(patch);
+            }
+            filled = filled && (patch->texture != nullptr || patch->elevLoaded || patch->coarseElevLoaded);
+            complete = complete && patch->loadDone.load() && !patch->generating && !patch->textureStreaming && !needsIntegration(*patch);
+        }
+
+        plan.filled.push_back(filled);
+        plan.complete.push_back(complete);
+    }
+
+    return plan;
+}
+
+void MGLMars::applyFramePlan()
+{
+    if (!framePlanWork.valid()) {
+        return;
+    }
+    FramePlan plan = framePlanWork.get();
+
+    for (auto& target : plan.textureTargets) {
+        std::shared_ptr<Patch>& patch = target.first;
+        patch->textureTargetLevel = target.second;
+        if (patch->visible && !patch->pending && needsIntegration(*patch)) {
+            patch->pending = true;
+            pendingPatches.push_back(patch);
+        }
+    }
+
+    for (size_t i = 0; i < views.size(); ++i) {
+        PatchView& view = *views[i];
+        view.drawList.swap(view.nextDrawList);
+        view.nextDrawList.clear(); // may hold the last references to patches about to be evicted
+        view.complete = plan.complete[i];
+        if (!view.visibleFilled && plan.filled[i]) {
+            reportVisibleFilled(view);
+        }
+    }
+}
+
+GLuint MGLMars::getTextureTargetLevel(double distance) const
+{
+    // the arc of a patch along a meridian, longitude only narrows it towards the poles
+    const double patchSize = MARS_SEMIMAJOR_AXIS * marsScale * (180.0 / PATCH_GRID_HEIGHT) * Aftr::DEGtoRADd;
+    const GLuint coarsestLevel = MarsCore::getNumMipLevels(PATCH_RESOLUTION) - 1;
+
+    // distance to the closest part of the patch, which sets how many pixels its texels cover
+    double pixels = patchSize / std::max(distance - patchSize * 0.75, patchSize * 0.01) * pixelsPerRadian;
+
+    // each level halves the texels across the patch
+    if (pixels >= PATCH_RESOLUTION) {
+        return 0;
+    }
+    return std::min(static_cast<GLuint>(std::log2(PATCH_RESOLUTION / pixels)), coarsestLevel);
+}
+
+void MGLMars::dropTextureLevels()
+{
+    if (textureBudgetBytes == 0 || residentTextureBytes <= textureBudgetBytes) {
+        return;
+    }
+
+    // patches holding finer levels than they need, farthest from every view first
+    std::vector<std::pair<double, Patch*>> receding;
+    for (uint32_t index : residentPatches) {
+        Patch* patch = patches[index].get();
+        if (patch->texID != 0 && !patch->textureStreaming && patch->textureLevel < patch->textureTargetLevel) {
+            receding.emplace_back(getViewDistance(patch->center), patch);
+        }
     }
+    std::sort(receding.begin(), receding.end(), [](const std::pair<double, Patch*>& a, const std::pair<double, Patch*>& b) {
+        return a.first > b.first;
+    });
 
-    return patchX + patchY * 360;
+    for (auto& entry : receding) {
+        if (residentTextureBytes <= textureBudgetBytes) {
+            break;
+        }
+        Patch* patch = entry.second;
+
+        // release the storage of the fine levels and clamp sampling to the remaining ones
+        glBindTexture(GL_TEXTURE_2D, patch->texID);
+        for (GLuint level = patch->textureLevel; level < patch->textureTargetLevel; ++level) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, patch->textureTargetLevel);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        residentTextureBytes -= getTextureBytes(patch->textureLevel) - getTextureBytes(patch->textureTargetLevel);
+        patch->textureLevel = patch->textureTargetLevel;
+    }
 }
 
 VectorD MGLMars::getRelativeToCenter(const VectorD& p) const
@@ -204,204 +806,415 @@ VectorD MGLMars::getRelativeToCenter(const VectorD& p) const
     return VectorD(out[0], out[1], out[2]);
 }
 
-std::shared_ptr<Patch> MGLMars::getPatch(uint32_t tile)
+double MGLMars::getViewDistance(const VectorD& p) const
 {
-    auto i = patches.find(tile);
+    // views that haven't been updated yet have no camera position
+    double distance = std::numeric_limits<double>::max();
+    for (auto& view : views) {
+        if (view->camera != nullptr) {
+            distance = std::min(distance, (p - view->camPos).magnitude());
+        }
+    }
+    return distance;
+}
 
-    if (i != patches.end()) {
-        return i->second;
-    } else {
-        return nullptr;
+PatchView& MGLMars::getView(const Camera& cam)
+{
+    // cameras the terrain isn't updated for (e.g. shadow passes) see the first view
+    for (auto& view : views) {
+        if (view->camera == &cam) {
+            return *view;
+        }
     }
+    return *views.front();
 }
 
-std::shared_ptr<Patch> MGLMars::createUpdateGetPatch(uint32_t index)
+void MGLMars::prefetch(uint32_t index)
 {
-    auto i = patches.insert(std::make_pair(index, nullptr));
+    // build the visible set up front so its tiles load in parallel with the rest of startup
+    PatchView& view = *views.front();
+    if (!view.nextVisibleWork.valid()) {
+        prepareVisiblePatches(view, index, view.governor.getRadius());
+        view.nextVisibleWork.get();
+        generateVisiblePatches(view);
+    }
 
-    double r = 90.0;
+    // requests are otherwise only started by update, which doesn't run until the first frame
+    pumpLoads();
+    std::cout << "Mars: prefetching " << residentPatches.size() << " patches with "
+        << tileLoader->getNumInFlight() << " tile requests in flight" << std::endl;
+}
 
-    std::shared_ptr<Patch> patch;
-    if (i.second) { // inserted new element
-        patch = generatePatch(index);
-        i.first->second = patch;
-    } else {
-        patch = i.first->second;
+size_t MGLMars::addView()
+{
+    applyFramePlan();
+
+    auto view = std::make_unique<PatchView>();
+    view->governor.loadConfig();
+    views.push_back(std::move(view));
+    for (auto& each : views) {
+        each->governor.setNumViews(views.size());
     }
+    return views.size() - 1;
+}
 
-    // create OpenGL texture if the data has been loaded
-    if (patch->texture == nullptr && patch->imgReady.load()) {
-        GLuint texID;
-        glGenTextures(1, &texID);
-        glBindTexture(GL_TEXTURE_2D, texID);
+void MGLMars::removeView(size_t view)
+{
+    if (view == 0 || view >= views.size()) {
+        return;
+    }
+    applyFramePlan();
+
+    // patches only it was preparing are kept until they're evicted
+    PatchView& removed = *views[view];
+    if (removed.nextVisibleWork.valid()) {
+        removed.nextVisibleWork.wait();
+        for (uint32_t index : removed.nextGenerated) {
+            patches.at(index)->generating = false;
+        }
+    }
+    views.erase(views.begin() + view);
+    for (auto& each : views) {
+        each->governor.setNumViews(views.size());
+    }
+    mergeViews();
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+size_t MGLMars::getNumViews() const
+{
+    return views.size();
+}
 
-        // use tightly packed data
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+bool MGLMars::isViewComplete(size_t view) const
+{
+    // as of the frame plan the draw list being rendered was built by
+    const PatchView& checked = *views.at(view);
+    return checked.complete && !checked.nextVisibleWork.valid();
+}
 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, PATCH_RESOLUTION, PATCH_RESOLUTION,
-            0, GL_RGB, GL_UNSIGNED_BYTE, &patch->imgData[0]);
-        glGenerateMipmap(GL_TEXTURE_2D);
+VectorD MGLMars::getWorldFromMars2000(const VectorD& p) const
+{
+    VectorD pos = toCartesianFromMars2000(p, marsScale);
+    double in[4] = { pos.x, pos.y, pos.z, 1.0 };
+    double out[4];
+    transformVector4DThrough4x4Matrix(in, out, (getModelMatrix().toMatD() * referenceInv).getPtr());
 
-        // reset to default
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return VectorD(out[0], out[1], out[2]);
+}
 
-        // generate CPU side texture data
-        TextureDataOwnsGLHandle* tex = new TextureDataOwnsGLHandle("DynamicTexture");
-        tex->isMipmapped(true);
-        tex->setTextureDimensionality(GL_TEXTURE_2D);
-        tex->setGLInternalFormat(GL_RGB);
-        tex->setGLRawTexelFormat(GL_RGB);
-        tex->setGLRawTexelType(GL_UNSIGNED_BYTE);
-        tex->setTextureDimensions(PATCH_RESOLUTION, PATCH_RESOLUTION);
-        tex->setGLTex(texID);
+std::shared_ptr<TerrainQuery> MGLMars::getTerrainQuery() const
+{
+    return terrainQuery;
+}
 
-        patch->texture = new TextureOwnsTexDataOwnsGLHandle(tex);
-        patch->texture->setWrapS(GL_CLAMP_TO_EDGE);
-        patch->texture->setWrapT(GL_CLAMP_TO_EDGE);
+#ifdef AFTR_CONFIG_USE_ODE
+std::shared_ptr<TerrainCollider> MGLMars::getTerrainCollider() const
+{
+    return terrainCollider;
+}
+#endif
+
+std::shared_ptr<Patch> MGLMars::getPatch(uint32_t index)
+{
+    return patches.at(index);
+}
+
+bool MGLMars::needsIntegration(const Patch& patch)
+{
+    return !patch.geometryUploaded
+        || patch.detail != patch.targetDetail
+        || (!patch.imgLoaded && patch.imgReady.load())
+        || (patch.texID != 0 && !patch.textureStreaming && patch.textureLevel > patch.textureTargetLevel)
+        || (!patch.imgLoaded && !patch.coarseImgLoaded && patch.coarseImgReady.load())
+        || (!patch.elevLoaded && patch.elevReady.load())
+        || (!patch.elevLoaded && !patch.coarseElevLoaded && patch.coarseElevReady.load());
+}
+
+void MGLMars::integratePendingPatches()
+{
+    // integrate the patches closest to any camera first, the rest are carried over to the next frame
+    std::vector<std::pair<double, std::shared_ptr<Patch>>> byDistance;
+    byDistance.reserve(pendingPatches.size());
+    for (auto& patch : pendingPatches) {
+        byDistance.emplace_back(getViewDistance(patch->center), patch);
+    }
+    std::sort(byDistance.begin(), byDistance.end(),
+        [](const std::pair<double, std::shared_ptr<Patch>>& a, const std::pair<double, std::shared_ptr<Patch>>& b) {
+            return a.first < b.first;
+        });
+    for (size_t i = 0; i < byDistance.size(); ++i) {
+        pendingPatches[i] = std::move(byDistance[i].second);
     }
 
-    // apply elevation offsets if the data has been loaded
-    if (!patch->elevLoaded && patch->elevReady.load()) {
-        uint32_t patchX = index % 360;
-        uint32_t patchY = index / 360;
+    const auto start = std::chrono::steady_clock::now();
+    size_t bytesUploaded = 0;
+    bool budgetLeft = true;
+    for (auto& patch : pendingPatches) {
+        while (budgetLeft && needsIntegration(*patch)) {
+            size_t bytes;
+            // always allow at least one step per frame so a small budget can't stall streaming
+            if (bytesUploaded > 0) {
+                double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                budgetLeft = (uploadBudgetMs <= 0.0 || elapsedMs < uploadBudgetMs)
+                    && (uploadBudgetBytes == 0 || bytesUploaded < uploadBudgetBytes);
+                if (!budgetLeft) {
+                    break;
+                }
+            }
 
-        uint32_t nextIndex = (patchX + 1) + (patchY + 1) * 360;
+            bytes = integratePatch(patch);
+            if (bytes == 0) {
+                break; // waiting on a free texture streaming slot or on the patch's vertices, retry next frame
+            }
+            bytesUploaded += bytes;
+        }
+
+        if (!budgetLeft) {
+            break;
+        }
+    }
+
+    // drop patches that are fully integrated, they are requeued when more of their data arrives
+    auto done = std::remove_if(pendingPatches.begin(), pendingPatches.end(),
+        [](const std::shared_ptr<Patch>& patch) { return !needsIntegration(*patch); });
+    for (auto i = done; i != pendingPatches.end(); ++i) {
+        (*i)->pending = false;
+    }
+    pendingPatches.erase(done, pendingPatches.end());
+}
+
+size_t MGLMars::integratePatch(const std::shared_ptr<Patch>& patch)
+{
+    const bool canStreamTexture = textureStreamer->hasFreeSlot();
+
+    // the flat geometry must be resident before anything else is applied to it
+    if (!patch->geometryUploaded) {
+        return patch->generating ? 0 : uploadPatchGeometry(*patch);
+    } else if (patch->detail != patch->targetDetail) {
+        return updatePatchDetail(*patch);
+    } else if (canStreamTexture && !patch->imgLoaded && patch->imgReady.load()) {
+        // only the levels the patch needs at its current distance, finer ones are refined in later
+        const GLuint lastLevel = MarsCore::getNumMipLevels(PATCH_RESOLUTION) - 1;
+        size_t bytes = createPatchTexture(patch, 0, patch->imgData, PATCH_RESOLUTION, patch->textureTargetLevel, lastLevel);
+        patch->imgLoaded = bytes > 0;
+        return bytes;
+    } else if (canStreamTexture && patch->texID != 0 && !patch->textureStreaming && patch->textureLevel > patch->textureTargetLevel) {
+        // one level at a time, so approaching patches share the budget
+        const GLuint level = patch->textureLevel - 1;
+        size_t bytes = createPatchTexture(patch, patch->texID, patch->imgData, PATCH_RESOLUTION, level, level);
+        patch->textureStreaming = bytes > 0;
+        return bytes;
+    } else if (!patch->elevLoaded && patch->elevReady.load()) {
+        patch->elevLoaded = true;
+        size_t bytes = applyPatchElevation(*patch, patch->elevPositions);
+        std::vector<Vector>().swap(patch->coarseElevPositions); // if the full elevation came first
+        if (patch->mesh != nullptr) {
+            bytes += updatePatchDetail(*patch); // switch to the adaptive mesh
+        }
+        return bytes;
+    } else if (canStreamTexture && !patch->imgLoaded && !patch->coarseImgLoaded && patch->coarseImgReady.load()) {
+        const GLuint lastLevel = MarsCore::getNumMipLevels(coarseResolution) - 1;
+        size_t bytes = createPatchTexture(patch, 0, patch->coarseImgData, coarseResolution, 0, lastLevel);
+        patch->coarseImgLoaded = bytes > 0;
+        if (patch->coarseImgLoaded) {
+            std::vector<GLubyte>().swap(patch->coarseImgData);
+        }
+        return bytes;
+    } else if (!patch->elevLoaded && !patch->coarseElevLoaded && patch->coarseElevReady.load()) {
+        patch->coarseElevLoaded = true;
+        return applyPatchElevation(*patch, patch->coarseElevPositions);
+    }
+
+    return 0;
+}
+
+size_t MGLMars::uploadPatchGeometry(Patch& patch)
+{
+    std::shared_ptr<PatchArray> array = patchArrays.at(patch.arrayGroup);
+    array->uploadVertexSegment(patch.arrayIndex, 1);
+    patch.geometryUploaded = true;
+
+    return NUM_VERTS_PER_PATCH * sizeof(GLVertex) + updatePatchDetail(patch);
+}
 
-        VectorD ul = getMars2000FromPatchIndex(index);
-        VectorD lr = getMars2000FromPatchIndex(nextIndex);
+size_t MGLMars::updatePatchDetail(Patch& patch)
+{
+    std::shared_ptr<PatchArray> array = patchArrays.at(patch.arrayGroup);
+    GLuint baseVertIndex = array->getPatchVertexStartIndex(patch.arrayIndex);
+    GLuint* indexPtr = array->getPatchIndexStart(patch.arrayIndex);
 
-        std::shared_ptr<PatchArray> array = patchArrays.at(patch->arrayGroup);
-        GLVertex* vertPtr = array->getPatchVertexStart(patch->arrayIndex);
-        for (GLuint y = 0; y < PATCH_RESOLUTION; ++y) {
-            // calculate the lattitude at this subdivison level
-            double v = static_cast<double>(y) / (PATCH_RESOLUTION - 1);
-            double lat = ul.x + (lr.x - ul.x) * v;
+    const MarsCore::AdaptiveMesh* adaptive = patch.elevLoaded ? patch.mesh.get() : nullptr;
+    // each detail level doubles the tolerance, like the uniform grid halves its tessellation
+    const float maxError = meshError * static_cast<float>(1u << std::min(patch.targetDetail, PATCH_MAX_DETAIL));
 
-            for (GLuint x = 0; x < PATCH_RESOLUTION; ++x) {
-                // calculate the longitude at this subdivision level
-                double u = static_cast<double>(x) / (PATCH_RESOLUTION - 1);
-                double lon = ul.y + (lr.y - ul.y) * u;
+    if (adaptive == nullptr || patch.lonDetail > 0) {
+        patch.indexCount = MarsCore::generateGridIndices(indexPtr, baseVertIndex, patch.targetDetail, patch.lonDetail);
+    }
 
-                // combine lat and lon into spherical coordinate
-                VectorD mars2000 = VectorD(lat, lon, 0);
-                mars2000.z = static_cast<double>(patch->elevData[x + y * PATCH_RESOLUTION]);
-                VectorD cart = toCartesianFromMars2000(mars2000, marsScale);
+    // near the poles the grid narrowed along longitude can use fewer triangles than the adaptive mesh
+    if (adaptive != nullptr && (patch.lonDetail == 0 || adaptive->countTriangles(maxError) * 3 < patch.indexCount)) {
+        patch.indexCount = adaptive->generateIndices(indexPtr, baseVertIndex, maxError);
+    }
+    patch.detail = patch.targetDetail;
+
+    // post data to OpenGL
+    array->uploadPatchIndices(patch.arrayIndex, patch.indexCount);
 
-                // transform based on reference
-                double in[4] = { cart.x, cart.y, cart.z, 1.0 };
-                double out[4];
-                transformVector4DThrough4x4Matrix(in, out, referenceInv.getPtr());
+    return patch.indexCount * sizeof(GLuint);
+}
 
-                // write back into a VectorD
-                VectorD pos(out[0], out[1], out[2]);
+size_t MGLMars::createPatchTexture(const std::shared_ptr<Patch>& patch, GLuint texID, const std::vector<GLubyte>& chain, GLuint resolution, GLuint firstLevel, GLuint lastLevel)
+{
+    // the texture or its new levels are swapped in once the transfer completes
+    if (!textureStreamer->upload(patch, texID, &chain[0], resolution, firstLevel, lastLevel)) {
+        return 0;
+    }
 
-                vertPtr->pos = pos.toVecS();
+    return MarsCore::getMipOffset(resolution, lastLevel + 1, PATCH_TEXTURE_CHANNELS) - MarsCore::getMipOffset(resolution, firstLevel, PATCH_TEXTURE_CHANNELS);
+}
 
-                vertPtr++; // advance pointer
+void MGLMars::swapInPatchTextures()
+{
+    for (auto& streamed : textureStreamer->collectFinished()) {
+        std::shared_ptr<Patch> patch = streamed.patch.lock();
+        if (patch == nullptr) { // evicted while streaming
+            if (streamed.created) {
+                glDeleteTextures(1, &streamed.texID);
             }
+            continue;
         }
 
-        // post data to OpenGL
-        array->uploadVertexSegment(patch->arrayIndex, 1);
-        patch->elevLoaded = true;
-    }
+        if (!streamed.created) {
+            // finer levels of the full texture, sampling can include them now
+            glBindTexture(GL_TEXTURE_2D, streamed.texID);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streamed.baseLevel);
+            glBindTexture(GL_TEXTURE_2D, 0);
 
-    return patch;
+            residentTextureBytes += getTextureBytes(streamed.baseLevel) - getTextureBytes(patch->textureLevel);
+            patch->textureLevel = streamed.baseLevel;
+            patch->textureStreaming = false;
+            continue;
+        }
+
+        // generate CPU side texture data
+        TextureDataOwnsGLHandle* tex = new TextureDataOwnsGLHandle("DynamicTexture");
+        tex->isMipmapped(true);
+        tex->setTextureDimensionality(GL_TEXTURE_2D);
+        tex->setGLInternalFormat(GL_RGBA);
+        tex->setGLRawTexelFormat(GL_RGBA);
+        tex->setGLRawTexelType(GL_UNSIGNED_BYTE);
+        tex->setTextureDimensions(streamed.resolution, streamed.resolution);
+        tex->setGLTex(streamed.texID);
+
+        // replaces the coarse texture when refining, coarse transfers always finish first
+        delete patch->texture;
+        patch->texture = new TextureOwnsTexDataOwnsGLHandle(tex);
+        patch->texture->setWrapS(GL_CLAMP_TO_EDGE);
+        patch->texture->setWrapT(GL_CLAMP_TO_EDGE);
+
+        if (streamed.resolution == PATCH_RESOLUTION) {
+            patch->texID = streamed.texID;
+            patch->textureLevel = streamed.baseLevel;
+            residentTextureBytes += getTextureBytes(streamed.baseLevel);
+        }
+    }
 }
 
-std::shared_ptr<Patch> MGLMars::generatePatch(uint32_t index)
+size_t MGLMars::applyPatchElevation(Patch& patch, std::vector<Vector>& positions)
 {
-    uint32_t patchX = index % 360;
-    uint32_t patchY = index / 360;
+    // the positions were built on a decode thread, they only need to be copied into the vertices
+    std::shared_ptr<PatchArray> array = patchArrays.at(patch.arrayGroup);
+    GLVertex* vertPtr = array->getPatchVertexStart(patch.arrayIndex);
+    for (const Vector& pos : positions) {
+        vertPtr->pos = pos;
+        vertPtr++; // advance pointer
+    }
+    std::vector<Vector>().swap(positions);
+
+    // post data to OpenGL
+    array->uploadVertexSegment(patch.arrayIndex, 1);
 
-    uint32_t nextIndex = (patchX + 1) + (patchY + 1) * 360;
+    return NUM_VERTS_PER_PATCH * sizeof(GLVertex);
+}
 
+std::shared_ptr<Patch> MGLMars::generatePatch(uint32_t index)
+{
     VectorD ul = getMars2000FromPatchIndex(index);
-    VectorD lr = getMars2000FromPatchIndex(nextIndex);
+    VectorD lr = getLowerRightMars2000FromPatchIndex(index);
 
     // create new patch
     std::shared_ptr<Patch> patch = std::make_shared<Patch>();
     patch->id = index;
+    patch->lonDetail = MarsCore::getLongitudeDetail(index);
+    patch->textureTargetLevel = MarsCore::getNumMipLevels(PATCH_RESOLUTION) - 1; // refined by the next frame plan
+
+    if (!freeSlots.empty()) {
+        // reuse the slot of an evicted patch
+        patch->arrayGroup = freeSlots.back().first;
+        patch->arrayIndex = freeSlots.back().second;
+        freeSlots.pop_back();
+    } else {
+        if (patchArrays.empty() || patchArrays.back()->size == patchArrays.back()->capacity) {
+            // generate a new patch array
+            patchArrays.push_back(std::make_shared<PatchArray>());
+        }
 
-    if (patchArrays.empty() || patchArrays.back()->size == patchArrays.back()->capacity) {
-        // generate a new patch array
-        patchArrays.push_back(std::make_shared<PatchArray>());
+        patch->arrayGroup = patchArrays.size() - 1;
+        patch->arrayIndex = patchArrays.back()->size++;
     }
 
-    auto& array = patchArrays.back();
+    residentPatches.push_back(index);
+
+    // vertices are generated separately (see generatePatchVertices), off the main thread
+    // indices are generated when the patch is integrated, at the detail level of its ring
+    // geometry is posted to OpenGL once the patch is integrated under the per-frame budget
+    patch->center = toCartesianFromMars2000(VectorD((ul.x + lr.x) / 2.0, (ul.y + lr.y) / 2.0, 0.0), marsScale);
 
-    patch->arrayGroup = patchArrays.size() - 1;
-    patch->arrayIndex = array->size++;
+    {
+        std::lock_guard<std::mutex> lock(loadMutex);
+        if (coarseResolution > 0 && coarseFailures.load() < COARSE_FAILURE_LIMIT) {
+            coarseLoadQueue.push_back(patch.get());
+        } else {
+            refineLoadQueue.push_back(patch.get());
+        }
+    }
+
+    return patch;
+}
+
+void MGLMars::generatePatchVertices(uint32_t index, double scale, const Mat4D& refInv, GLVertex* vertPtr)
+{
+    // the same positions the terrain export writes
+    std::vector<MarsCore::Vec3d> positions(NUM_VERTS_PER_PATCH);
+    MarsCore::generatePatchPositions(index, nullptr, scale, positions.data());
 
     // generate patch vertices and tex coords
-    GLVertex* vertPtr = array->getPatchVertexStart(patch->arrayIndex);
+    const MarsCore::Vec3d* cartPtr = positions.data();
     for (GLuint y = 0; y < PATCH_RESOLUTION; ++y) {
-        // calculate the lattitude at this subdivison level
         double v = static_cast<double>(y) / (PATCH_RESOLUTION - 1);
-        double lat = ul.x + (lr.x - ul.x) * v;
 
         for (GLuint x = 0; x < PATCH_RESOLUTION; ++x) {
-            // calculate the longitude at this subdivision level
             double u = static_cast<double>(x) / (PATCH_RESOLUTION - 1);
-            double lon = ul.y + (lr.y - ul.y) * u;
+            VectorD cart(cartPtr->x, cartPtr->y, cartPtr->z);
 
-            // combine lat and lon into mars2000 coordinate
-            VectorD mars2000 = VectorD(lat, lon, 0.0);
-            VectorD cart = toCartesianFromMars2000(mars2000, marsScale);
-
-            // transform based on reference
-            double in[4] = { cart.x, cart.y, cart.z, 1.0 };
-            double out[4];
-            transformVector4DThrough4x4Matrix(in, out, referenceInv.getPtr());
-
-            // write back into a VectorD
-            VectorD pos(out[0], out[1], out[2]);
-
-            vertPtr->pos = pos.toVecS();
-            vertPtr->norm = (referenceInv * cart).normalizeMe().toVecS();
+            vertPtr->pos = toReferenceFrame(*cartPtr, refInv).toVecS();
+            vertPtr->norm = (refInv * cart).normalizeMe().toVecS();
             vertPtr->texCoord = aftrTexture4f(static_cast<GLfloat>(u), static_cast<GLfloat>(v));
 
             vertPtr++; // advance pointer
+            cartPtr++;
         }
     }
+}
 
-    GLuint width = PATCH_RESOLUTION;
-
-    // generate indices
-    GLuint baseVertIndex = array->getPatchVertexStartIndex(patch->arrayIndex);
-    GLuint* indexPtr = array->getPatchIndexStart(patch->arrayIndex);
-    for (GLuint y = 0; y < PATCH_RESOLUTION - 1; ++y) {
-        for (GLuint x = 0; x < PATCH_RESOLUTION - 1; ++x) {
-            // convert 2d array indices to 1d array indices
-            GLuint ul = x + y * width + baseVertIndex;
-            GLuint ll = x + (y + 1) * width + baseVertIndex;
-            GLuint lr = (x + 1) + (y + 1) * width + baseVertIndex;
-            GLuint ur = (x + 1) + y * width + baseVertIndex;
-
-            // top-left triangle
-            indexPtr[0] = ul;
-            indexPtr[1] = ll;
-            indexPtr[2] = ur;
-
-            // bottom-right triangle
-            indexPtr[3] = ll;
-            indexPtr[4] = lr;
-            indexPtr[5] = ur;
+void MGLMars::generateElevatedPositions(uint32_t index, const std::vector<int16_t>& data, double scale, const Mat4D& refInv, std::vector<Vector>& positions)
+{
+    // the same positions the terrain export writes
+    std::vector<MarsCore::Vec3d> cart(NUM_VERTS_PER_PATCH);
+    MarsCore::generatePatchPositions(index, data.data(), scale, cart.data());
 
-            indexPtr += 6; // advance pointer
-        }
+    positions.resize(NUM_VERTS_PER_PATCH);
+    for (size_t i = 0; i < cart.size(); ++i) {
+        positions[i] = toReferenceFrame(cart[i], refInv).toVecS();
     }
-
-    // post data to OpenGL
-    array->uploadVertexSegment(patch->arrayIndex, 1);
-    array->uploadIndexSegment(patch->arrayIndex, 1);
-
-    asyncPatchesToLoad.push(patch.get());
-
-    return patch;
 }
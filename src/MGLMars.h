@@ -1,8 +1,11 @@
 #pragma once
 
 #include <array>
-#include <map>
-#include <set>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <vector>
 #include <thread>
 
 #include "boost/lockfree/queue.hpp"
@@ -12,6 +15,12 @@
 
 #include "Constants.h"
 #include "GLPatchArray.h"
+#include "RenderRadiusGovernor.h"
+#include "TerrainCollider.h"
+#include "TerrainQuery.h"
+#include "TextureStreamer.h"
+#include "TileLoader.h"
+#include "core/AdaptiveMesh.h"
 
 namespace Aftr {
     // essentially a pointer to a patch (with pointers initialized to invalid)
@@ -22,20 +31,62 @@ namespace Aftr {
         GLuint arrayIndex = std::numeric_limits<GLuint>::max();
 
         Texture* texture = nullptr;
-
+        GLuint texID = 0; // GL handle of the full imagery texture, owned by texture once swapped in
+        GLuint textureLevel = 0; // finest mip level resident in the full imagery texture
+        GLuint textureTargetLevel = 0; // finest mip level the patch's largest projected size calls for
+        bool textureStreaming = false; // mip levels of the full imagery texture are in transfer
+
+        VectorD center; // cartesian center of the patch on the ellipsoid, used to prioritize uploads
+        bool geometryUploaded = false;
+        bool visible = false; // member of any view's visible set (main thread only)
+        bool generating = false; // vertices are being generated on a view's worker (main thread only)
+        bool pending = false; // queued for integration (main thread only)
+        uint32_t detail = 0; // detail level of the indices in the index buffer
+        uint32_t targetDetail = 0; // detail level wanted for the patch's closest ring in any view
+        uint32_t lonDetail = 0; // extra detail levels along longitude, patches narrow towards the poles
+        GLuint indexCount = 0; // number of indices in the index buffer
         bool elevLoaded = false;
+        bool coarseElevLoaded = false;
+        bool imgLoaded = false; // full imagery handed to the texture streamer
+        bool coarseImgLoaded = false; // coarse imagery handed to the texture streamer
         std::vector<int16_t> elevData;
         std::atomic<bool> elevReady = false;
-        std::vector<GLubyte> imgData;
+        std::vector<GLubyte> imgData; // mip chain of the full imagery, kept so dropped levels can be streamed in again
         std::atomic<bool> imgReady = false;
+        std::vector<Vector> elevPositions; // vertex positions of elevData in the reference frame, built by the loader and freed once applied
+        std::vector<int16_t> coarseElevData; // coarse elevation resampled to PATCH_RESOLUTION
+        std::vector<Vector> coarseElevPositions; // vertex positions of coarseElevData, freed once applied
+        std::atomic<bool> coarseElevReady = false;
+        std::vector<GLubyte> coarseImgData; // mip chain of the coarse imagery
+        std::atomic<bool> coarseImgReady = false;
+        std::atomic<int32_t> loadPriority = std::numeric_limits<int32_t>::max(); // ring around the camera patch, lower loads first
+        std::atomic<bool> loadDone = false; // set once the loaders are finished with the patch
+        std::unique_ptr<MarsCore::AdaptiveMesh> mesh; // adaptive mesh of elevData, its indices are extracted for each detail level as it's needed
         std::array<bool, 8> fixedGaps;
     };
 
-    struct PatchComparator {
-        bool operator()(const std::shared_ptr<Patch>& a, const std::shared_ptr<Patch>& b) const
-        {
-            return (a->id) < (b->id);
-        }
+    // what one camera sees of the terrain, the views share the patches and their buffers and textures
+    // so a patch visible in several views is loaded and uploaded once
+    struct PatchView {
+        const Camera* camera = nullptr; // camera of the last update, render picks the view by it
+        VectorD camPos; // relative to the center of Mars
+        RenderRadiusGovernor governor;
+        std::vector<std::shared_ptr<Patch>> visiblePatches; // sorted in render order (by buffer)
+        std::vector<std::pair<uint32_t, int32_t>> visibleRings; // ids and rings of the visible set
+        std::vector<std::pair<uint32_t, int32_t>> nextVisible; // ids and rings of the visible set being prepared
+        std::vector<std::shared_ptr<Patch>> nextPatches; // patches of the prepared set, sorted in render order on the worker
+        std::vector<uint32_t> nextGenerated; // ids of the patches whose vertices the worker generates
+        uint32_t nextCenter = std::numeric_limits<uint32_t>::max(); // patch the prepared visible set is built around
+        int32_t nextRadius = -1;
+        bool nextListed = false; // the worker has listed the prepared set, its new patches get their slots next
+        std::future<void> nextVisibleWork; // lists the prepared set, then generates its new patches' vertices and sorts it
+        std::vector<std::shared_ptr<Patch>> drawList; // uploaded visible patches in render order, what render submits
+        std::vector<std::shared_ptr<Patch>> nextDrawList; // filled by the frame worker, swapped in at the next update
+        bool complete = false; // everything the draw list needs was loaded and integrated as of the last frame plan
+        uint32_t visibleCenter = std::numeric_limits<uint32_t>::max(); // patch the visible set was built around
+        int32_t visibleRadius = -1; // radius the visible set was built with
+        std::chrono::steady_clock::time_point visibleSince; // when the visible set last changed
+        bool visibleFilled = true; // every visible patch shows some real data
     };
 
     class MGLMars : public MGL {
@@ -48,28 +99,108 @@ namespace Aftr {
         void render(const Camera& cam) override;
         void renderSelection(const Camera& cam, GLubyte red, GLubyte green, GLubyte blue) override;
 
-        void update(const Camera& cam);
+        // one camera per view in view order, views without a camera keep their last visible set
+        void update(const std::vector<const Camera*>& cameras);
+        void prefetch(uint32_t index);
+
+        // there is always at least the first view
+        size_t addView();
+        void removeView(size_t view);
+        size_t getNumViews() const;
+        // the view's visible set is built around its camera and every patch in it is fully loaded
+        // (or failed to load) and integrated
+        bool isViewComplete(size_t view) const;
+
+        VectorD getWorldFromMars2000(const VectorD& p) const;
+
+        std::shared_ptr<TerrainQuery> getTerrainQuery() const;
+#ifdef AFTR_CONFIG_USE_ODE
+        std::shared_ptr<TerrainCollider> getTerrainCollider() const;
+#endif
 
     protected:
         double marsScale;
         Mat4D reference;
         Mat4D referenceInv;
-        std::vector<std::thread> asyncThreads;
-        std::atomic<bool> shutdownMsg;
-        boost::lockfree::queue<Patch*> asyncPatchesToLoad;
+        std::unique_ptr<TileLoader> tileLoader;
+        std::mutex loadMutex;
+        std::deque<Patch*> coarseLoadQueue; // patches waiting for their coarse tiles, loaded first
+        std::vector<Patch*> refineLoadQueue; // patches waiting for their full tiles, loaded by priority
+        GLuint coarseResolution; // resolution of the coarse tiles (0 disables progressive loading)
+        float meshError; // error tolerance of the adaptive meshes in meters (<= 0 keeps the uniform grid)
+        std::atomic<uint64_t> meshTriangles; // triangles of all adaptive meshes built at full detail
+        std::atomic<uint64_t> meshPatches; // number of adaptive meshes built
+        std::atomic<uint32_t> coarseFailures;
+        boost::lockfree::queue<uint32_t> asyncPatchesLoaded; // ids of patches with newly arrived data
 
         typedef GLPatchArray<NUM_PATCHES_PER_BUFFER> PatchArray;
-        std::map<uint32_t, std::shared_ptr<Patch>> patches;
-        std::set<std::shared_ptr<Patch>, PatchComparator> visiblePatches;
+        std::vector<std::shared_ptr<Patch>> patches; // indexed directly by patch id
         std::vector<std::shared_ptr<PatchArray>> patchArrays;
+        std::vector<std::pair<size_t, GLuint>> freeSlots; // patch array slots released by evicted patches
+        std::vector<uint32_t> residentPatches; // ids of all patches currently in the table
+        std::vector<std::unique_ptr<PatchView>> views;
+        std::vector<std::shared_ptr<Patch>> visibleUnion; // patches visible in any view
+        bool evictionDue = false; // the visible sets changed, patches are evicted once no draw list references them
+
+        // worked out between the end of an update and the start of the next one, while nothing changes the patches
+        struct FramePlan {
+            std::vector<std::pair<std::shared_ptr<Patch>, GLuint>> textureTargets; // patches whose texture level target changed
+            std::vector<bool> filled; // per view, every visible patch shows some real data
+            std::vector<bool> complete; // per view, every visible patch is loaded and integrated
+        };
+        std::future<FramePlan> framePlanWork;
 
         GLuint vao;
 
-        static uint32_t getNeighborPatchIndex(uint32_t x, uint32_t y, int32_t dx, int32_t dy);
+        double uploadBudgetMs; // per-frame time budget for integrating loaded patch data (<= 0 disables)
+        size_t uploadBudgetBytes; // per-frame GPU upload budget in bytes (0 disables)
+        std::vector<std::shared_ptr<Patch>> pendingPatches; // visible patches with data waiting to be integrated
+
+        std::unique_ptr<TextureStreamer> textureStreamer;
+        size_t textureBudgetBytes; // memory of the full patch textures before fine levels are dropped
+        size_t residentTextureBytes; // memory of the mip levels resident in the full patch textures
+        double pixelsPerRadian; // viewport pixels per radian of the field of view
+        std::shared_ptr<TerrainQuery> terrainQuery;
+#ifdef AFTR_CONFIG_USE_ODE
+        std::shared_ptr<TerrainCollider> terrainCollider; // null if terrain collision is disabled
+#endif
+        bool loadMetricsEnabled; // print the fill times and adaptive mesh savings
+        bool queryBenchmarkEnabled;
+        std::future<void> queryBenchmark;
+        std::chrono::steady_clock::time_point lastUpdate;
+
+        void pumpLoads();
+        void startLoad(Patch* patch, bool coarse);
+        void buildPatchMesh(Patch& patch);
+        void reportVisibleFilled(PatchView& view);
+        void runQueryBenchmark(const VectorD& origin);
 
         VectorD getRelativeToCenter(const VectorD& p) const;
+        double getViewDistance(const VectorD& p) const;
+        PatchView& getView(const Camera& cam);
         std::shared_ptr<Patch> getPatch(uint32_t index);
-        std::shared_ptr<Patch> createUpdateGetPatch(uint32_t index);
         std::shared_ptr<Patch> generatePatch(uint32_t index);
+        static void generatePatchVertices(uint32_t index, double scale, const Mat4D& refInv, GLVertex* vertPtr);
+        static void generateElevatedPositions(uint32_t index, const std::vector<int16_t>& data, double scale, const Mat4D& refInv, std::vector<Vector>& positions);
+        void updateView(PatchView& view, const Camera& cam, double frameMs);
+        void prepareVisiblePatches(PatchView& view, uint32_t center, int32_t radius);
+        void generateVisiblePatches(PatchView& view);
+        void applyVisiblePatches(PatchView& view);
+        void mergeViews();
+        void evictPatches();
+        void startFramePlan();
+        FramePlan planFrame();
+        void applyFramePlan();
+        GLuint getTextureTargetLevel(double distance) const;
+        void dropTextureLevels();
+
+        static bool needsIntegration(const Patch& patch);
+        void integratePendingPatches();
+        size_t integratePatch(const std::shared_ptr<Patch>& patch);
+        size_t uploadPatchGeometry(Patch& patch);
+        size_t updatePatchDetail(Patch& patch);
+        size_t createPatchTexture(const std::shared_ptr<Patch>& patch, GLuint texID, const std::vector<GLubyte>& chain, GLuint resolution, GLuint firstLevel, GLuint lastLevel);
+        void swapInPatchTextures();
+        size_t applyPatchElevation(Patch& patch, std::vector<Vector>& positions);
     };
 }
\ No newline at end of file
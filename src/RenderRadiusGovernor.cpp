@@ -0,0 +1,150 @@
+#include "RenderRadiusGovernor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "AftrOpenGLIncludes.h"
+#include "core/Mars2000.h"
+
+#include "Constants.h"
+#include "Utils.h"
+
+using namespace Aftr;
+
+constexpr double FRAME_TIME_SMOOTHING = 0.05; // weight of the newest frame in the moving average
+constexpr double FRAME_TIME_SHRINK_RATIO = 1.1; // shrink when frames are this much slower than the target
+constexpr double FRAME_TIME_GROW_RATIO = 0.75; // grow only when frames are this much faster than the target
+constexpr auto RADIUS_CHANGE_COOLDOWN = std::chrono::milliseconds(1000); // time for a change to show up in the frame time
+
+RenderRadiusGovernor::RenderRadiusGovernor()
+{
+    targetFrameMs = TARGET_FRAME_MS;
+    configMinRadius = PATCH_MIN_RENDER_RADIUS;
+    minRadius = PATCH_MIN_RENDER_RADIUS;
+    maxRadius = PATCH_MAX_RENDER_RADIUS;
+    fullDetailRings = 1;
+    maxResidentPatches = MAX_RESIDENT_PATCHES;
+    viewResidentPatches = MAX_RESIDENT_PATCHES;
+
+    radius = PATCH_RENDER_RADIUS;
+    smoothedFrameMs = 0.0;
+    lastChange = std::chrono::steady_clock::now();
+    countCenter = NUM_PATCHES;
+}
+
+void RenderRadiusGovernor::loadConfig()
+{
+    targetFrameMs = getConfigDouble("marsTargetFrameMs", TARGET_FRAME_MS);
+    configMinRadius = std::max(static_cast<int32_t>(getConfigDouble("marsMinRenderRadius", PATCH_MIN_RENDER_RADIUS)), 0);
+    maxRadius = std::max(static_cast<int32_t>(getConfigDouble("marsMaxRenderRadius", PATCH_MAX_RENDER_RADIUS)), configMinRadius);
+    fullDetailRings = std::max(static_cast<int32_t>(getConfigDouble("marsFullDetailRings", 1)), 0);
+    maxResidentPatches = static_cast<size_t>(std::max(getConfigDouble("marsMaxResidentPatches", static_cast<double>(MAX_RESIDENT_PATCHES)), 1.0));
+
+    setNumViews(1);
+}
+
+void RenderRadiusGovernor::setNumViews(size_t numViews)
+{
+    viewResidentPatches = std::max<size_t>(maxResidentPatches / std::max<size_t>(numViews, 1), 1);
+
+    // the minimum radius must always fit in the share, wherever the camera is
+    minRadius = configMinRadius;
+    while (minRadius > 0 && getMaxPatchCount(minRadius) > viewResidentPatches) {
+        --minRadius;
+    }
+
+    // a larger set than the new share allows shrinks on the next update
+    radius = std::clamp(radius, minRadius, maxRadius);
+    countCenter = NUM_PATCHES;
+}
+
+void RenderRadiusGovernor::update(double frameMs, uint32_t center, double altitude)
+{
+    if (center != countCenter) {
+        countCenter = center;
+        patchCounts.clear();
+        for (int32_t r = 0; r <= maxRadius + 1; ++r) {
+            patchCounts.push_back(getPatchCount(center, r));
+        }
+    }
+
+    // smooth the frame time so single slow frames (e.g. streaming hitches) don't cause changes
+    if (smoothedFrameMs <= 0.0) {
+        smoothedFrameMs = frameMs;
+    } else {
+        smoothedFrameMs += (frameMs - smoothedFrameMs) * FRAME_TIME_SMOOTHING;
+    }
+
+    // the set widens towards the poles, shrink right away when it no longer fits in memory
+    const auto now = std::chrono::steady_clock::now();
+    int32_t fitRadius = radius;
+    while (fitRadius > minRadius && patchCounts[fitRadius] > viewResidentPatches) {
+        --fitRadius;
+    }
+    if (fitRadius != radius) {
+        radius = fitRadius;
+        lastChange = now;
+        return;
+    }
+
+    if (now - lastChange < RADIUS_CHANGE_COOLDOWN) {
+        return; // let the last change settle
+    }
+
+    const int32_t altitudeRadius = std::clamp(getAltitudeRadius(altitude), minRadius, maxRadius);
+    const bool overBudget = smoothedFrameMs > targetFrameMs * FRAME_TIME_SHRINK_RATIO;
+    const bool underBudget = smoothedFrameMs < targetFrameMs * FRAME_TIME_GROW_RATIO && patchCounts[radius + 1] <= viewResidentPatches;
+
+    int32_t newRadius = radius;
+    if (radius > altitudeRadius || overBudget) {
+        newRadius = radius - 1;
+    } else if (radius < altitudeRadius && underBudget) {
+        newRadius = radius + 1;
+    }
+    newRadius = std::clamp(newRadius, minRadius, maxRadius);
+
+    if (newRadius != radius) {
+        radius = newRadius;
+        lastChange = now;
+    }
+}
+
+uint32_t RenderRadiusGovernor::getRingDetail(int32_t ring) const
+{
+    if (ring <= fullDetailRings) {
+        return 0;
+    }
+
+    // halve the tessellation each time the distance to the camera patch doubles
+    double ratio = static_cast<double>(ring) / static_cast<double>(fullDetailRings + 1);
+    uint32_t detail = 1 + static_cast<uint32_t>(std::floor(std::log2(ratio)));
+
+    return std::min(detail, PATCH_MAX_DETAIL);
+}
+
+size_t RenderRadiusGovernor::getPatchCount(uint32_t center, int32_t radius)
+{
+    std::vector<std::pair<uint32_t, int32_t>> rings;
+    MarsCore::getPatchRings(center, radius, PATCH_MAX_LONGITUDE_WIDENING, rings);
+    return rings.size();
+}
+
+size_t RenderRadiusGovernor::getMaxPatchCount(int32_t radius)
+{
+    // the set only depends on the row, and is symmetric about the equator
+    size_t count = 0;
+    for (uint32_t row = 0; row < PATCH_GRID_HEIGHT / 2; ++row) {
+        count = std::max(count, getPatchCount(row * PATCH_GRID_WIDTH, radius));
+    }
+    return count;
+}
+
+int32_t RenderRadiusGovernor::getAltitudeRadius(double altitude)
+{
+    // distance to the horizon over a sphere with the equatorial radius
+    double h = std::max(altitude, 0.0);
+    double horizon = std::sqrt(2.0 * MARS_SEMIMAJOR_AXIS * h + h * h);
+    double patchWidth = MARS_SEMIMAJOR_AXIS * (360.0 / PATCH_GRID_WIDTH) * Aftr::DEGtoRADd;
+
+    return static_cast<int32_t>(std::ceil(horizon / patchWidth));
+}
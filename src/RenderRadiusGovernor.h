@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace Aftr {
+    // decides at runtime how many rings of patches are rendered around the camera, and at what
+    // detail level, from the frame time, the size of the visible set and the camera altitude
+    class RenderRadiusGovernor {
+    public:
+        RenderRadiusGovernor();
+
+        void loadConfig();
+        // the views share marsMaxResidentPatches, each governor keeps its set within an equal share
+        void setNumViews(size_t numViews);
+        void update(double frameMs, uint32_t center, double altitude);
+
+        int32_t getRadius() const { return radius; }
+        uint32_t getRingDetail(int32_t ring) const;
+        size_t getMaxResidentPatches() const { return maxResidentPatches; }
+
+        // patches in the visible set of a radius around a patch, rows widen towards the poles
+        static size_t getPatchCount(uint32_t center, int32_t radius);
+        // the most patches the visible set of a radius has anywhere on the planet
+        static size_t getMaxPatchCount(int32_t radius);
+
+    protected:
+        double targetFrameMs;
+        int32_t configMinRadius;
+        int32_t minRadius; // the configured minimum, lowered until it fits in the view's share anywhere
+        int32_t maxRadius;
+        int32_t fullDetailRings; // rings around the camera patch that are always rendered at full detail
+        size_t maxResidentPatches; // of all views together
+        size_t viewResidentPatches; // this view's share
+
+        int32_t radius;
+        double smoothedFrameMs;
+        std::chrono::steady_clock::time_point lastChange;
+
+        // visible set sizes around the camera patch for each radius, recounted when the camera moves to another patch
+        uint32_t countCenter;
+        std::vector<size_t> patchCounts;
+
+        static int32_t getAltitudeRadius(double altitude);
+    };
+}
@@ -0,0 +1,340 @@
+#include "SharedTileCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+using namespace Aftr;
+
+using namespace boost::interprocess;
+
+constexpr uint32_t CACHE_MAGIC = 0x4D415253; // "MARS", set once the header is written
+constexpr uint32_t CACHE_VERSION = 3;
+constexpr uint32_t MAX_PROBES = 64; // entries searched before a tile is treated as not cacheable
+constexpr size_t KEY_LENGTH = 96; // request path of the tile, including the terminator
+constexpr int64_t CLAIM_TIMEOUT_MS = 10000; // claims older than this are assumed to belong to a process that died
+constexpr int64_t OPEN_TIMEOUT_MS = 1000; // how long to wait on another process that is creating or removing the segment
+constexpr uint32_t SEGMENT_REMOVED = 0xFFFFFFFF; // attach count once the last process detached, nothing may attach anymore
+
+enum EntryState : uint32_t {
+    ENTRY_EMPTY = 0, // hash claimed, key not written yet (taken over like a claim if its process died)
+    ENTRY_WRITING,
+    ENTRY_READY,
+    ENTRY_FAILED,
+    ENTRY_REUSING // taken for another key, left like this if its process dies before claiming it
+};
+
+struct SharedTileCache::Header {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t numTiles;
+    uint64_t tileSize;
+    std::atomic<uint32_t> attached; // processes with the segment mapped
+};
+
+struct SharedTileCache::Entry {
+    std::atomic<uint64_t> hash; // 0 while unused
+    std::atomic<uint32_t> state;
+    uint32_t size;
+    std::atomic<int64_t> claimedAt; // ms since epoch, shared clock of all processes on the host, 0 until claimed
+    std::atomic<uint32_t> readers; // hits not released yet, pins of a process that crashed keep the entry forever
+    std::atomic<uint32_t> referenced; // read since the last sweep passed it
+    char key[KEY_LENGTH];
+};
+
+// atomics must work across address spaces
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free
+    && std::atomic<int64_t>::is_always_lock_free, "shared tile cache requires lock free atomics");
+
+static size_t alignSize(size_t size)
+{
+    return (size + 63) & ~static_cast<size_t>(63);
+}
+
+static int64_t nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t hashKey(const std::string& key)
+{
+    // FNV-1a, 0 marks unused entries
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : key) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+
+    return hash == 0 ? 1 : hash;
+}
+
+size_t SharedTileCache::getSegmentSize(uint32_t numTiles, size_t tileSize)
+{
+    return alignSize(sizeof(Header)) + alignSize(numTiles * sizeof(Entry)) + numTiles * tileSize;
+}
+
+std::shared_ptr<SharedTileCache> SharedTileCache::open(const std::string& name, uint32_t numTiles, size_t tileSize)
+{
+    const size_t size = getSegmentSize(numTiles, tileSize);
+    const int64_t deadline = nowMs() + OPEN_TIMEOUT_MS;
+
+    try {
+        while (true) {
+            shared_memory_object segment;
+            bool created = false;
+            try {
+                segment = shared_memory_object(create_only, name.c_str(), read_write);
+                segment.truncate(size); // zero filled, so every entry starts out unused
+                created = true;
+            } catch (const interprocess_exception&) {
+                segment = shared_memory_object(open_only, name.c_str(), read_write);
+            }
+
+            // the creating process may not have sized the segment yet
+            offset_t existingSize = 0;
+            while (segment.get_size(existingSize) && existingSize == 0 && nowMs() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            if (static_cast<size_t>(existingSize) != size) {
+                std::cerr << "WARNING: Shared tile cache " << name << " has a different size than configured (" << existingSize
+                    << " bytes, expected " << size << " bytes), it will not be used." << std::endl;
+                return nullptr;
+            }
+
+            std::shared_ptr<SharedTileCache> cache(new SharedTileCache(name, std::move(segment), numTiles, tileSize));
+            Header* header = static_cast<Header*>(cache->region.get_address());
+            if (created) {
+                header->version = CACHE_VERSION;
+                header->numTiles = numTiles;
+                header->tileSize = tileSize;
+                header->attached.store(1);
+                header->magic.store(CACHE_MAGIC, std::memory_order_release);
+                cache->header = header;
+                return cache;
+            }
+
+            while (header->magic.load(std::memory_order_acquire) != CACHE_MAGIC && nowMs() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            if (header->magic.load(std::memory_order_acquire) != CACHE_MAGIC || header->version != CACHE_VERSION
+                || header->numTiles != numTiles || header->tileSize != tileSize) {
+                std::cerr << "WARNING: Shared tile cache " << name << " has a different layout than configured, it will not be used." << std::endl;
+                return nullptr;
+            }
+
+            uint32_t attached = header->attached.load();
+            while (attached != SEGMENT_REMOVED && !header->attached.compare_exchange_weak(attached, attached + 1)) {
+            }
+            if (attached != SEGMENT_REMOVED) {
+                cache->header = header;
+                return cache;
+            }
+
+            // the last process is removing it, create a new one once it's gone
+            if (nowMs() >= deadline) {
+                std::cerr << "WARNING: Shared tile cache " << name << " is being removed, it will not be used." << std::endl;
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    } catch (const interprocess_exception& e) {
+        std::cerr << "WARNING: Unable to map shared tile cache " << name << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+bool SharedTileCache::remove(const std::string& name)
+{
+    return shared_memory_object::remove(name.c_str());
+}
+
+SharedTileCache::SharedTileCache(const std::string& name, shared_memory_object&& segment, uint32_t numTiles, size_t tileSize)
+    : name(name)
+    , segment(std::move(segment))
+    , region(this->segment, read_write)
+    , header(nullptr) // set by open once attached
+    , numTiles(numTiles)
+    , tileSize(tileSize)
+{
+    unsigned char* base = static_cast<unsigned char*>(region.get_address());
+    entries = reinterpret_cast<Entry*>(base + alignSize(sizeof(Header)));
+    tiles = base + alignSize(sizeof(Header)) + alignSize(numTiles * sizeof(Entry));
+}
+
+SharedTileCache::~SharedTileCache()
+{
+    if (header == nullptr) {
+        return;
+    }
+
+    // the last process to detach removes the segment, marked first so nothing attaches to it meanwhile
+    uint32_t attached = header->attached.load();
+    while (!header->attached.compare_exchange_weak(attached, attached == 1 ? SEGMENT_REMOVED : attached - 1)) {
+    }
+    if (attached == 1) {
+        remove(name);
+    }
+}
+
+SharedTileCache::Lookup SharedTileCache::acquire(const std::string& key)
+{
+    Lookup result;
+    if (key.size() >= KEY_LENGTH) {
+        return result;
+    }
+
+    // linear probing from the key's hash, the first unused entry is claimed for the key
+    const uint64_t hash = hashKey(key);
+    const uint32_t probes = std::min(MAX_PROBES, numTiles);
+    for (uint32_t i = 0; i < probes; ++i) {
+        const uint32_t index = static_cast<uint32_t>((hash + i) % numTiles);
+        Entry& entry = entries[index];
+
+        uint64_t current = entry.hash.load(std::memory_order_acquire);
+        if (current == 0 && entry.hash.compare_exchange_strong(current, hash, std::memory_order_acq_rel)) {
+            entry.claimedAt.store(nowMs());
+            std::strncpy(entry.key, key.c_str(), KEY_LENGTH);
+            entry.state.store(ENTRY_WRITING, std::memory_order_release);
+
+            result.status = Status::Claimed;
+            result.entry = index;
+            return result;
+        }
+
+        if (current == hash) {
+            return lookupEntry(index, key);
+        }
+    }
+
+    // the window is full, sweep it like a clock. Entries read since the last pass get a second chance
+    for (uint32_t i = 0; i < 2 * probes; ++i) {
+        const uint32_t index = static_cast<uint32_t>((hash + i % probes) % numTiles);
+        if (entries[index].referenced.exchange(0) == 0 && reuseEntry(index, hash, key)) {
+            result.status = Status::Claimed;
+            result.entry = index;
+            return result;
+        }
+    }
+
+    return result;
+}
+
+bool SharedTileCache::reuseEntry(uint32_t index, uint64_t hash, const std::string& key)
+{
+    // only settled entries nobody is reading, claims in progress belong to their process
+    Entry& entry = entries[index];
+    uint32_t state = entry.state.load();
+    if ((state != ENTRY_READY && state != ENTRY_FAILED) || entry.readers.load() != 0
+        || !entry.state.compare_exchange_strong(state, ENTRY_REUSING)) {
+        return false;
+    }
+
+    // a reader may have pinned it before the state changed, it sees the new state otherwise
+    if (entry.readers.load() != 0) {
+        entry.state.store(state);
+        return false;
+    }
+
+    entry.claimedAt.store(nowMs());
+    entry.hash.store(hash);
+    std::strncpy(entry.key, key.c_str(), KEY_LENGTH);
+    entry.state.store(ENTRY_WRITING, std::memory_order_release);
+    return true;
+}
+
+SharedTileCache::Lookup SharedTileCache::check(uint32_t entry, const std::string& key)
+{
+    return lookupEntry(entry, key);
+}
+
+SharedTileCache::Lookup SharedTileCache::lookupEntry(uint32_t index, const std::string& key)
+{
+    Entry& entry = entries[index];
+    Lookup result;
+    result.entry = index;
+
+    uint32_t state = entry.state.load(std::memory_order_acquire);
+    if (state == ENTRY_EMPTY) {
+        // another process is writing the key, or died between claiming the hash and writing it
+        result.status = Status::Busy;
+        if (takeOverClaim(entry)) {
+            std::strncpy(entry.key, key.c_str(), KEY_LENGTH);
+            entry.state.store(ENTRY_WRITING, std::memory_order_release);
+            result.status = Status::Claimed;
+        }
+        return result;
+    }
+
+    if (state == ENTRY_REUSING) {
+        result.status = Status::Busy; // the key is being replaced, it won't match once that's done
+        return result;
+    }
+
+    if (std::strncmp(entry.key, key.c_str(), KEY_LENGTH) != 0) {
+        return result; // hash collision with another tile, or the entry was reused
+    }
+
+    if (state == ENTRY_READY) {
+        // pinned before checking again, the entry may have been reused for another tile since
+        entry.readers.fetch_add(1);
+        if (entry.state.load() == ENTRY_READY && std::strncmp(entry.key, key.c_str(), KEY_LENGTH) == 0) {
+            entry.referenced.store(1, std::memory_order_relaxed);
+            result.status = Status::Hit;
+            result.data = tiles + index * tileSize;
+            result.size = entry.size;
+        } else {
+            entry.readers.fetch_sub(1);
+            result.status = Status::Busy;
+        }
+    } else if (state == ENTRY_FAILED) {
+        // retry the fetch of a tile that failed in another process
+        result.status = entry.state.compare_exchange_strong(state, ENTRY_WRITING, std::memory_order_acq_rel) ? Status::Claimed : Status::Busy;
+        if (result.status == Status::Claimed) {
+            entry.claimedAt.store(nowMs());
+        }
+    } else {
+        result.status = takeOverClaim(entry) ? Status::Claimed : Status::Busy;
+    }
+
+    return result;
+}
+
+bool SharedTileCache::takeOverClaim(Entry& entry)
+{
+    // a process that died before even stamping its claim left no time, the timeout starts when it's first seen
+    int64_t claimedAt = entry.claimedAt.load();
+    if (claimedAt == 0) {
+        entry.claimedAt.compare_exchange_strong(claimedAt, nowMs());
+        return false;
+    }
+
+    // take over claims of processes that went away
+    return nowMs() - claimedAt > CLAIM_TIMEOUT_MS && entry.claimedAt.compare_exchange_strong(claimedAt, nowMs());
+}
+
+void SharedTileCache::publish(uint32_t index, const unsigned char* data, size_t size)
+{
+    if (size > tileSize) {
+        abandon(index);
+        return;
+    }
+
+    Entry& entry = entries[index];
+    std::memcpy(tiles + index * tileSize, data, size);
+    entry.size = static_cast<uint32_t>(size);
+    entry.referenced.store(1, std::memory_order_relaxed);
+    entry.state.store(ENTRY_READY, std::memory_order_release);
+}
+
+void SharedTileCache::abandon(uint32_t index)
+{
+    entries[index].state.store(ENTRY_FAILED, std::memory_order_release);
+}
+
+void SharedTileCache::release(uint32_t index)
+{
+    entries[index].readers.fetch_sub(1, std::memory_order_release);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/interprocess/shared_memory_object.hpp"
+
+namespace Aftr {
+    // raw tile responses shared between processes through a named shared memory segment. The first process
+    // to fetch a tile publishes it and the others read it in place. The index is an open addressed table
+    // updated with atomics only. Only the downloaded bytes are shared, every process still decodes the
+    // tiles it reads into its own memory.
+    // a hit pins its entry until release() is called, once the table is full a clock sweep over the
+    // key's probe window reuses an unpinned entry that wasn't read since the last sweep.
+    // the segment counts the processes attached to it and is removed when the last one detaches, a
+    // process that crashes leaves it behind until remove() is called.
+    class SharedTileCache {
+    public:
+        enum class Status {
+            Hit, // the tile is published, data points into the shared segment until the entry is released
+            Claimed, // the caller must fetch the tile and publish or abandon the entry
+            Busy, // another process is fetching the tile, check the entry again later
+            Full // no entry available, fetch the tile without caching it (the entry was reused if it was waited on)
+        };
+
+        struct Lookup {
+            Status status = Status::Full;
+            uint32_t entry = 0;
+            const unsigned char* data = nullptr;
+            size_t size = 0;
+        };
+
+        // opens or creates the segment, nullptr if it can't be mapped or its layout doesn't match
+        static std::shared_ptr<SharedTileCache> open(const std::string& name, uint32_t numTiles, size_t tileSize);
+        // removes the segment even if processes are still attached, they keep their mapping
+        static bool remove(const std::string& name);
+        ~SharedTileCache();
+
+        Lookup acquire(const std::string& key);
+        Lookup check(uint32_t entry, const std::string& key);
+        void publish(uint32_t entry, const unsigned char* data, size_t size);
+        void abandon(uint32_t entry);
+        // unpins the entry of a hit once its data is no longer read
+        void release(uint32_t entry);
+
+        uint32_t getNumTiles() const { return numTiles; }
+        size_t getTileSize() const { return tileSize; }
+
+    protected:
+        struct Header;
+        struct Entry;
+
+        std::string name;
+        boost::interprocess::shared_memory_object segment;
+        boost::interprocess::mapped_region region;
+        Header* header;
+        uint32_t numTiles;
+        size_t tileSize;
+        Entry* entries;
+        unsigned char* tiles;
+
+        SharedTileCache(const std::string& name, boost::interprocess::shared_memory_object&& segment, uint32_t numTiles, size_t tileSize);
+
+        Lookup lookupEntry(uint32_t entry, const std::string& key);
+        bool reuseEntry(uint32_t entry, uint64_t hash, const std::string& key);
+        static bool takeOverClaim(Entry& entry);
+        static size_t getSegmentSize(uint32_t numTiles, size_t tileSize);
+    };
+}
@@ -0,0 +1,190 @@
+#include "TerrainCollider.h"
+
+#ifdef AFTR_CONFIG_USE_ODE
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Constants.h"
+#include "Utils.h"
+
+using namespace Aftr;
+
+constexpr double COLLISION_THICKNESS = 1000.0; // meters of solid terrain below the lowest sample, so fast bodies don't tunnel through
+
+TerrainCollider::TerrainCollider(double scale)
+    : marsScale(scale)
+{
+    space = dHashSpaceCreate(nullptr);
+    dSpaceSetCleanup(space, 0); // the heightfields are destroyed along with their data
+}
+
+TerrainCollider::~TerrainCollider()
+{
+    for (auto& entry : geoms) {
+        destroyGeom(entry.second);
+    }
+    dSpaceDestroy(space);
+}
+
+std::shared_ptr<const PatchCollisionShape> TerrainCollider::buildShape(const PatchHeightField& field, double scale)
+{
+    const uint32_t id = field.getId();
+    VectorD ul = getMars2000FromPatchIndex(id);
+    VectorD lr = getLowerRightMars2000FromPatchIndex(id);
+    const double lat = (ul.x + lr.x) / 2.0;
+    const double lon = (ul.y + lr.y) / 2.0;
+
+    // tangent frame at the center of the patch, up is the ellipsoid normal
+    auto shape = std::make_shared<PatchCollisionShape>();
+    shape->id = id;
+    shape->center = toCartesianFromMars2000(VectorD(lat, lon, 0.0), scale);
+    shape->up = (toCartesianFromMars2000(VectorD(lat, lon, 1.0), scale) - shape->center).normalizeMe();
+    VectorD north = toCartesianFromMars2000(VectorD(lat + 0.01, lon, 0.0), scale) - shape->center;
+    north = (north - shape->up * north.dotProduct(shape->up)).normalizeMe();
+    shape->east = north.crossProduct(shape->up);
+    shape->south = north * -1.0;
+
+    // the grid covers the patch's footprint, which is wider on its equator side
+    double halfWidth = 0.0;
+    double halfDepth = 0.0;
+    for (double cornerLat : { ul.x, lat, lr.x }) {
+        for (double cornerLon : { ul.y, lr.y }) {
+            VectorD d = toCartesianFromMars2000(VectorD(cornerLat, cornerLon, 0.0), scale) - shape->center;
+            halfWidth = std::max(halfWidth, std::abs(d.dotProduct(shape->east)));
+            halfDepth = std::max(halfDepth, std::abs(d.dotProduct(shape->south)));
+        }
+    }
+    shape->width = halfWidth * 2.0;
+    shape->depth = halfDepth * 2.0;
+
+    // project each grid point onto the ellipsoid, sample the terrain there and measure its height
+    // above the tangent plane, so the curvature of the patch is part of the heights
+    shape->heights.resize(PATCH_RESOLUTION * PATCH_RESOLUTION);
+    int16_t minHeight = std::numeric_limits<int16_t>::max();
+    int16_t maxHeight = std::numeric_limits<int16_t>::min();
+    for (GLuint z = 0; z < PATCH_RESOLUTION; ++z) {
+        const double offsetZ = (static_cast<double>(z) / (PATCH_RESOLUTION - 1) - 0.5) * shape->depth;
+        for (GLuint x = 0; x < PATCH_RESOLUTION; ++x) {
+            const double offsetX = (static_cast<double>(x) / (PATCH_RESOLUTION - 1) - 0.5) * shape->width;
+            VectorD planar = shape->center + shape->east * offsetX + shape->south * offsetZ;
+
+            // samples outside the patch (at the corners of the footprint) are clamped to its edge
+            VectorD mars2000 = toMars2000FromCartesian(planar, scale);
+            mars2000.z = field.heightAt(mars2000.x, mars2000.y);
+            VectorD surface = toCartesianFromMars2000(mars2000, scale);
+
+            double height = std::round((surface - shape->center).dotProduct(shape->up) / scale);
+            int16_t sample = static_cast<int16_t>(std::clamp(height, -32768.0, 32767.0));
+            shape->heights[x + z * PATCH_RESOLUTION] = sample;
+            minHeight = std::min(minHeight, sample);
+            maxHeight = std::max(maxHeight, sample);
+        }
+    }
+    shape->minHeight = minHeight;
+    shape->maxHeight = maxHeight;
+
+    return shape;
+}
+
+void TerrainCollider::addPatch(const std::shared_ptr<const PatchCollisionShape>& shape)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    added.push_back(shape);
+}
+
+void TerrainCollider::removePatch(uint32_t id)
+{
+    {
+        // the shape may not have been picked up yet
+        std::lock_guard<std::mutex> lock(mutex);
+        added.erase(std::remove_if(added.begin(), added.end(),
+            [id](const std::shared_ptr<const PatchCollisionShape>& shape) { return shape->id == id; }), added.end());
+    }
+
+    auto found = geoms.find(id);
+    if (found != geoms.end()) {
+        destroyGeom(found->second);
+        geoms.erase(found);
+    }
+}
+
+void TerrainCollider::update(const Mat4D& marsToWorld)
+{
+    // every heightfield is moved along with the model
+    if (!std::equal(marsToWorld.getPtr(), marsToWorld.getPtr() + 16, this->marsToWorld.getPtr())) {
+        this->marsToWorld = marsToWorld;
+        for (auto& entry : geoms) {
+            placeGeom(entry.second);
+        }
+    }
+
+    std::vector<std::shared_ptr<const PatchCollisionShape>> shapes;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shapes.swap(added);
+    }
+
+    for (auto& shape : shapes) {
+        PatchGeom& patchGeom = geoms[shape->id];
+        destroyGeom(patchGeom);
+        patchGeom.shape = shape;
+
+        // heights are in meters, ODE scales them into world units
+        patchGeom.data = dGeomHeightfieldDataCreate();
+        dGeomHeightfieldDataBuildShort(patchGeom.data, shape->heights.data(), 0,
+            static_cast<dReal>(shape->width), static_cast<dReal>(shape->depth), PATCH_RESOLUTION, PATCH_RESOLUTION,
+            static_cast<dReal>(marsScale), 0, static_cast<dReal>(COLLISION_THICKNESS * marsScale), 0);
+        dGeomHeightfieldDataSetBounds(patchGeom.data, static_cast<dReal>(shape->minHeight * marsScale), static_cast<dReal>(shape->maxHeight * marsScale));
+
+        patchGeom.geom = dCreateHeightfield(space, patchGeom.data, 1);
+        placeGeom(patchGeom);
+    }
+}
+
+void TerrainCollider::placeGeom(const PatchGeom& patchGeom) const
+{
+    const PatchCollisionShape& shape = *patchGeom.shape;
+
+    double in[4] = { shape.center.x, shape.center.y, shape.center.z, 1.0 };
+    double out[4];
+    transformVector4DThrough4x4Matrix(in, out, marsToWorld.getPtr());
+    dGeomSetPosition(patchGeom.geom, static_cast<dReal>(out[0]), static_cast<dReal>(out[1]), static_cast<dReal>(out[2]));
+
+    // the columns of the rotation are the heightfield's axes in world space
+    dMatrix3 rotation = {};
+    const VectorD* axes[3] = { &shape.east, &shape.up, &shape.south };
+    for (int column = 0; column < 3; ++column) {
+        double axis[4] = { axes[column]->x, axes[column]->y, axes[column]->z, 0.0 };
+        transformVector4DThrough4x4Matrix(axis, out, marsToWorld.getPtr());
+        for (int row = 0; row < 3; ++row) {
+            rotation[row * 4 + column] = static_cast<dReal>(out[row]);
+        }
+    }
+    dGeomSetRotation(patchGeom.geom, rotation);
+}
+
+void TerrainCollider::destroyGeom(PatchGeom& patchGeom)
+{
+    if (patchGeom.geom != nullptr) {
+        dGeomDestroy(patchGeom.geom);
+        patchGeom.geom = nullptr;
+    }
+    if (patchGeom.data != nullptr) {
+        dGeomHeightfieldDataDestroy(patchGeom.data);
+        patchGeom.data = nullptr;
+    }
+}
+
+dSpaceID TerrainCollider::getSpace() const
+{
+    return space;
+}
+
+size_t TerrainCollider::getNumPatches() const
+{
+    return geoms.size();
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "AftrConfig.h"
+
+#ifdef AFTR_CONFIG_USE_ODE
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ode/ode.h"
+
+#include "Mat4.h"
+#include "Vector.h"
+
+#include "TerrainQuery.h"
+
+namespace Aftr {
+    // elevation of one patch resampled onto a regular grid in the tangent plane at its center,
+    // which is the shape an ODE heightfield takes, immutable once built
+    struct PatchCollisionShape {
+        uint32_t id;
+        VectorD center; // on the ellipsoid, in scaled mars coordinates
+        VectorD east; // heightfield x axis
+        VectorD up; // heightfield y axis
+        VectorD south; // heightfield z axis
+        double width; // extent along east, in scaled units
+        double depth; // extent along south, in scaled units
+        int16_t minHeight; // in meters above the tangent plane
+        int16_t maxHeight;
+        std::vector<int16_t> heights; // rows north to south, each west to east
+    };
+
+    // ODE heightfields of the resident patches, kept in their own space so bodies can be collided
+    // against the terrain with dSpaceCollide2 without the patches colliding with each other
+    class TerrainCollider {
+    public:
+        TerrainCollider(double scale);
+        ~TerrainCollider();
+
+        // resamples a patch's elevation, expensive enough to be done on the loader threads
+        static std::shared_ptr<const PatchCollisionShape> buildShape(const PatchHeightField& field, double scale);
+
+        // thread-safe, the heightfield is created on the next update
+        void addPatch(const std::shared_ptr<const PatchCollisionShape>& shape);
+
+        // main thread only, ODE isn't thread-safe
+        void removePatch(uint32_t id);
+        void update(const Mat4D& marsToWorld);
+
+        dSpaceID getSpace() const;
+        size_t getNumPatches() const;
+
+    protected:
+        struct PatchGeom {
+            std::shared_ptr<const PatchCollisionShape> shape; // referenced by the heightfield data, not copied
+            dHeightfieldDataID data = nullptr;
+            dGeomID geom = nullptr;
+        };
+
+        double marsScale;
+        dSpaceID space;
+        std::mutex mutex;
+        std::vector<std::shared_ptr<const PatchCollisionShape>> added; // built since the last update
+        std::unordered_map<uint32_t, PatchGeom> geoms;
+        Mat4D marsToWorld;
+
+        void placeGeom(const PatchGeom& patchGeom) const;
+        static void destroyGeom(PatchGeom& patchGeom);
+    };
+}
+
+#endif
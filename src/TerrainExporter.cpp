@@ -0,0 +1,209 @@
+#include "TerrainExporter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#include "core/PatchMesh.h"
+#include "core/PlyWriter.h"
+
+#include "Constants.h"
+#include "Utils.h"
+
+using namespace Aftr;
+
+constexpr size_t EXPORT_WINDOW_PATCHES = 32; // default patches held in memory while exporting, about 1.5 MB each
+constexpr size_t PROGRESS_INTERVAL = 64; // patches between progress messages
+
+int TerrainExporter::run(const std::vector<std::string>& args)
+{
+    const char* usage = "usage: --export-ply minLat minLon maxLat maxLon out.ply [--servers url,url] [--window patches]";
+    if (args.size() < 7) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+
+    double bounds[4];
+    for (size_t i = 0; i < 4; ++i) {
+        try {
+            bounds[i] = std::stod(args[2 + i]);
+        } catch (...) {
+            std::cerr << "Invalid coordinate " << args[2 + i] << "\n" << usage << std::endl;
+            return 1;
+        }
+    }
+    const double minLat = bounds[0];
+    const double minLon = bounds[1];
+    const double maxLat = bounds[2];
+    const double maxLon = bounds[3];
+    if (minLat >= maxLat || minLon >= maxLon || minLat < -90.0 || maxLat > 90.0 || minLon < -180.0 || maxLon > 180.0) {
+        std::cerr << "The region must have minLat < maxLat within [-90, 90] and minLon < maxLon within [-180, 180]" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> mirrors;
+    size_t window = EXPORT_WINDOW_PATCHES;
+    for (size_t i = 7; i + 1 < args.size(); i += 2) {
+        if (args[i] == "--servers") {
+            std::istringstream list(args[i + 1]);
+            std::string server;
+            while (std::getline(list, server, ',')) {
+                if (!server.empty()) {
+                    mirrors.push_back(server);
+                }
+            }
+        } else if (args[i] == "--window") {
+            window = static_cast<size_t>(std::max(std::atoi(args[i + 1].c_str()), 1));
+        } else {
+            std::cerr << "Unknown option " << args[i] << "\n" << usage << std::endl;
+            return 1;
+        }
+    }
+    if (mirrors.empty()) {
+        mirrors.push_back(TILE_SERVER_URL);
+    }
+
+    TerrainExporter exporter(mirrors, window);
+    return exporter.exportRegion(minLat, minLon, maxLat, maxLon, args[6]) ? 0 : 1;
+}
+
+TerrainExporter::TerrainExporter(const std::vector<std::string>& mirrorUrls, size_t window)
+    : slots(window)
+{
+    TileLoader::RetryPolicy retryPolicy;
+    retryPolicy.maxRetries = TILE_MAX_RETRIES;
+    retryPolicy.backoffMs = TILE_RETRY_BACKOFF_MS;
+    retryPolicy.negativeCacheSec = TILE_NEGATIVE_CACHE_SEC;
+
+    // the decode threads also build the vertices, so use every core
+    tileLoader = std::make_unique<TileLoader>(mirrorUrls, MAX_REQUESTS_IN_FLIGHT, std::max(std::thread::hardware_concurrency(), 1u), retryPolicy);
+}
+
+TerrainExporter::~TerrainExporter()
+{
+    // the callbacks fill the slots
+    tileLoader->shutdown();
+}
+
+std::vector<uint32_t> TerrainExporter::getPatchIndices(double minLat, double minLon, double maxLat, double maxLon)
+{
+    // every patch overlapping the region, rows north to south
+    const uint32_t firstY = static_cast<uint32_t>(std::clamp(std::floor(90.0 - maxLat), 0.0, PATCH_GRID_HEIGHT - 1.0));
+    const uint32_t lastY = static_cast<uint32_t>(std::clamp(std::ceil(90.0 - minLat) - 1.0, 0.0, PATCH_GRID_HEIGHT - 1.0));
+    const uint32_t firstX = static_cast<uint32_t>(std::clamp(std::floor(minLon + 180.0), 0.0, PATCH_GRID_WIDTH - 1.0));
+    const uint32_t lastX = static_cast<uint32_t>(std::clamp(std::ceil(maxLon + 180.0) - 1.0, 0.0, PATCH_GRID_WIDTH - 1.0));
+
+    std::vector<uint32_t> indices;
+    for (uint32_t y = firstY; y <= lastY; ++y) {
+        for (uint32_t x = firstX; x <= lastX; ++x) {
+            indices.push_back(x + y * PATCH_GRID_WIDTH);
+        }
+    }
+    return indices;
+}
+
+bool TerrainExporter::exportRegion(double minLat, double minLon, double maxLat, double maxLon, const std::string& path)
+{
+    const std::vector<uint32_t> indices = getPatchIndices(minLat, minLon, maxLat, maxLon);
+    if (indices.size() * NUM_VERTS_PER_PATCH > std::numeric_limits<uint32_t>::max()) {
+        std::cerr << "The region's " << indices.size() << " patches have too many vertices for one PLY file, split it up" << std::endl;
+        return false;
+    }
+
+    std::ostringstream comment;
+    comment << "Mars terrain from lat " << minLat << " to " << maxLat << ", lon " << minLon << " to " << maxLon
+            << ", meters from the center of Mars";
+    MarsCore::PlyWriter ply;
+    if (!ply.open(path, comment.str())) {
+        std::cerr << "Unable to open " << path << std::endl;
+        return false;
+    }
+
+    // a mesh with holes isn't left behind for later steps to pick up
+    auto abandon = [&ply, &path](const std::string& reason) {
+        std::cerr << reason << ", removing the incomplete " << path << std::endl;
+        ply.close();
+        std::remove(path.c_str());
+        return false;
+    };
+
+    std::cout << "Mars: exporting " << indices.size() << " patches to " << path << std::endl;
+    const auto start = std::chrono::steady_clock::now();
+
+    // fetch ahead of the patch being written, as far as the window allows, and write them in order
+    size_t nextFetch = 0;
+    size_t nextWrite = 0;
+    while (nextWrite < indices.size()) {
+        while (nextFetch < indices.size() && nextFetch - nextWrite < slots.size() && tileLoader->hasCapacity(1)) {
+            fetch(indices[nextFetch], slots[nextFetch % slots.size()]);
+            ++nextFetch;
+        }
+
+        // woken by every finished patch, so more can be fetched as the loader frees up
+        Slot& slot = slots[nextWrite % slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(readyMutex);
+            slotReady.wait_for(lock, std::chrono::milliseconds(10), [&slot]() { return slot.ready.load(); });
+        }
+        if (!slot.ready.load()) {
+            continue;
+        }
+
+        if (!slot.loaded) {
+            return abandon("Patch " + std::to_string(indices[nextWrite]) + " failed to load");
+        }
+        if (!ply.writeVertices(slot.positions.data(), slot.positions.size())) {
+            return abandon("Unable to write");
+        }
+        slot.ready.store(false);
+        ++nextWrite;
+
+        if (nextWrite % PROGRESS_INTERVAL == 0) {
+            std::cout << "Mars: exported " << nextWrite << "/" << indices.size() << " patches" << std::endl;
+        }
+    }
+
+    // the faces of each patch only depend on where its vertices start
+    std::vector<uint32_t> faceIndices(NUM_TRIS_PER_PATCH * 3);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        uint32_t count = MarsCore::generateGridIndices(faceIndices.data(), static_cast<uint32_t>(i * NUM_VERTS_PER_PATCH), 0);
+        if (!ply.writeFaces(faceIndices.data(), count / 3)) {
+            return abandon("Unable to write");
+        }
+    }
+
+    const uint64_t numFaces = ply.getNumFaces();
+    if (!ply.close()) {
+        return abandon("Unable to write");
+    }
+
+    double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Mars: exported " << indices.size() << " patches (" << numFaces << " triangles) in " << elapsedSec << " s, "
+        << indices.size() / std::max(elapsedSec, 1e-9) << " patches/sec" << std::endl;
+    return true;
+}
+
+void TerrainExporter::fetch(uint32_t index, Slot& slot)
+{
+    slot.loaded = false;
+    tileLoader->fetch(TILE_ELEVATION_ENDPOINT, index, PATCH_RESOLUTION, [this, index, &slot](const unsigned char* body, size_t size) {
+        std::vector<int16_t> elevation;
+        if (body != nullptr && decodeElevation(index, body, size, PATCH_RESOLUTION, elevation)) {
+            slot.positions.resize(NUM_VERTS_PER_PATCH);
+            MarsCore::generatePatchPositions(index, elevation.data(), 1.0, slot.positions.data());
+            slot.loaded = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            slot.ready.store(true);
+        }
+        slotReady.notify_all();
+    });
+}
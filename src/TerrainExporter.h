@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "core/Mars2000.h"
+
+#include "TileLoader.h"
+
+namespace Aftr {
+    // exports the terrain of a latitude/longitude box as one binary PLY mesh, with the same ellipsoid
+    // positions the patches are rendered with (unscaled, in meters from the center of Mars). Tiles are
+    // fetched through the tile loader and turned into vertices on its decode threads, and only a fixed
+    // window of patches is held in memory while they're written out in order.
+    class TerrainExporter {
+    public:
+        // runs "--export-ply minLat minLon maxLat maxLon out.ply [--servers url,url] [--window patches]",
+        // returns the process exit code
+        static int run(const std::vector<std::string>& args);
+
+        TerrainExporter(const std::vector<std::string>& mirrorUrls, size_t window);
+        ~TerrainExporter();
+
+        bool exportRegion(double minLat, double minLon, double maxLat, double maxLon, const std::string& path);
+
+    protected:
+        // a patch of the window, filled on a decode thread
+        struct Slot {
+            std::vector<MarsCore::Vec3d> positions;
+            bool loaded = false; // false if its tile failed
+            std::atomic<bool> ready = false;
+        };
+
+        std::unique_ptr<TileLoader> tileLoader;
+        std::vector<Slot> slots;
+        std::mutex readyMutex;
+        std::condition_variable slotReady;
+
+        static std::vector<uint32_t> getPatchIndices(double minLat, double minLon, double maxLat, double maxLon);
+        void fetch(uint32_t index, Slot& slot);
+    };
+}
@@ -0,0 +1,282 @@
+#include "TerrainQuery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include "Constants.h"
+#include "Utils.h"
+
+using namespace Aftr;
+
+constexpr GLuint QUADTREE_SIZE = PATCH_RESOLUTION; // cells along each side of the quadtree, the last row and column are padding
+constexpr double MARS_MAX_ELEVATION = 21300.0; // meters, above the summit of Olympus Mons
+constexpr double MIN_RAY_STEP = 0.25; // smallest ray step, in cells
+constexpr int32_t MAX_RAY_STEPS = 4096;
+constexpr int32_t RAY_REFINE_STEPS = 24;
+
+PatchHeightField::PatchHeightField(uint32_t id, const std::vector<int16_t>& elevation, bool coarse)
+    : id(id)
+    , coarse(coarse)
+    , elevation(elevation)
+{
+    VectorD ul = getMars2000FromPatchIndex(id);
+    north = ul.x;
+    west = ul.y;
+
+    // level 0, the range of the four corner samples of each cell
+    std::vector<int16_t> minLevel(QUADTREE_SIZE * QUADTREE_SIZE);
+    std::vector<int16_t> maxLevel(QUADTREE_SIZE * QUADTREE_SIZE);
+    for (GLuint y = 0; y < QUADTREE_SIZE; ++y) {
+        GLuint y1 = std::min(y + 1, PATCH_RESOLUTION - 1);
+        for (GLuint x = 0; x < QUADTREE_SIZE; ++x) {
+            GLuint x1 = std::min(x + 1, PATCH_RESOLUTION - 1);
+            int16_t a = elevation[x + y * PATCH_RESOLUTION];
+            int16_t b = elevation[x1 + y * PATCH_RESOLUTION];
+            int16_t c = elevation[x + y1 * PATCH_RESOLUTION];
+            int16_t d = elevation[x1 + y1 * PATCH_RESOLUTION];
+            minLevel[x + y * QUADTREE_SIZE] = std::min({ a, b, c, d });
+            maxLevel[x + y * QUADTREE_SIZE] = std::max({ a, b, c, d });
+        }
+    }
+    minLevels.push_back(std::move(minLevel));
+    maxLevels.push_back(std::move(maxLevel));
+
+    // each following level combines 2x2 nodes of the previous one
+    for (GLuint size = QUADTREE_SIZE / 2; size > 0; size /= 2) {
+        const std::vector<int16_t>& prevMin = minLevels.back();
+        const std::vector<int16_t>& prevMax = maxLevels.back();
+        const GLuint prevSize = size * 2;
+
+        std::vector<int16_t> nextMin(size * size);
+        std::vector<int16_t> nextMax(size * size);
+        for (GLuint y = 0; y < size; ++y) {
+            for (GLuint x = 0; x < size; ++x) {
+                GLuint i = x * 2 + y * 2 * prevSize;
+                nextMin[x + y * size] = std::min({ prevMin[i], prevMin[i + 1], prevMin[i + prevSize], prevMin[i + prevSize + 1] });
+                nextMax[x + y * size] = std::max({ prevMax[i], prevMax[i + 1], prevMax[i + prevSize], prevMax[i + prevSize + 1] });
+            }
+        }
+        minLevels.push_back(std::move(nextMin));
+        maxLevels.push_back(std::move(nextMax));
+    }
+}
+
+void PatchHeightField::getCellCoords(double lat, double lon, double& u, double& v) const
+{
+    u = std::clamp((lon - west) * (PATCH_RESOLUTION - 1), 0.0, static_cast<double>(PATCH_RESOLUTION - 1));
+    v = std::clamp((north - lat) * (PATCH_RESOLUTION - 1), 0.0, static_cast<double>(PATCH_RESOLUTION - 1));
+}
+
+double PatchHeightField::heightAt(double lat, double lon) const
+{
+    double u, v;
+    getCellCoords(lat, lon, u, v);
+
+    GLuint x0 = std::min(static_cast<GLuint>(u), PATCH_RESOLUTION - 2);
+    GLuint y0 = std::min(static_cast<GLuint>(v), PATCH_RESOLUTION - 2);
+    double tx = u - x0;
+    double ty = v - y0;
+
+    const int16_t* row0 = &elevation[y0 * PATCH_RESOLUTION];
+    const int16_t* row1 = row0 + PATCH_RESOLUTION;
+    double top = row0[x0] * (1.0 - tx) + row0[x0 + 1] * tx;
+    double bottom = row1[x0] * (1.0 - tx) + row1[x0 + 1] * tx;
+
+    return top * (1.0 - ty) + bottom * ty;
+}
+
+double PatchHeightField::getSafeStep(double lat, double lon, double altitude) const
+{
+    double u, v;
+    getCellCoords(lat, lon, u, v);
+
+    GLuint cx = std::min(static_cast<GLuint>(u), QUADTREE_SIZE - 1);
+    GLuint cy = std::min(static_cast<GLuint>(v), QUADTREE_SIZE - 1);
+
+    const double metersPerCellLat = MARS_SEMIMAJOR_AXIS * Aftr::DEGtoRADd / (PATCH_RESOLUTION - 1);
+    const double metersPerCellLon = metersPerCellLat * std::max(std::cos(lat * Aftr::DEGtoRADd), 1e-3);
+    const double minStep = MIN_RAY_STEP * std::min(metersPerCellLat, metersPerCellLon);
+
+    // the point can move by its height above a node's maximum without hitting anything in the node,
+    // larger nodes have more room to move in but a higher maximum, so take the best level
+    double best = 0.0;
+    for (size_t level = 0; level < maxLevels.size(); ++level) {
+        const GLuint size = QUADTREE_SIZE >> level;
+        const GLuint nodeSize = 1u << level;
+        const GLuint nx = cx >> level;
+        const GLuint ny = cy >> level;
+
+        double margin = altitude - maxLevels[level][nx + ny * size];
+        if (margin <= 0.0) {
+            continue;
+        }
+
+        double edgeX = std::min(u - nx * nodeSize, (nx + 1) * nodeSize - u) * metersPerCellLon;
+        double edgeY = std::min(v - ny * nodeSize, (ny + 1) * nodeSize - v) * metersPerCellLat;
+        double edge = std::max(std::min(edgeX, edgeY), minStep);
+
+        best = std::max(best, std::min(margin, edge));
+    }
+
+    return best;
+}
+
+TerrainQuery::TerrainQuery(double scale)
+    : marsScale(scale)
+{
+}
+
+void TerrainQuery::setWorldTransform(const Mat4D& worldToMars, const Mat4D& marsToWorld)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    this->worldToMars = worldToMars;
+    this->marsToWorld = marsToWorld;
+}
+
+void TerrainQuery::addPatch(const std::shared_ptr<const PatchHeightField>& field)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    fields[field->getId()] = field;
+}
+
+void TerrainQuery::removePatch(uint32_t id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    fields.erase(id);
+}
+
+size_t TerrainQuery::getNumPatches() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return fields.size();
+}
+
+std::vector<uint32_t> TerrainQuery::getPatchIds() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    std::vector<uint32_t> ids;
+    ids.reserve(fields.size());
+    for (auto& field : fields) {
+        ids.push_back(field.first);
+    }
+
+    return ids;
+}
+
+const PatchHeightField* TerrainQuery::findField(double lat, double lon) const
+{
+    auto i = fields.find(getPatchIndexFromMars2000(VectorD(lat, lon, 0.0)));
+    return i != fields.end() ? i->second.get() : nullptr;
+}
+
+bool TerrainQuery::heightAt(double lat, double lon, double& height, bool* coarse) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    const PatchHeightField* field = findField(lat, lon);
+    if (field == nullptr) {
+        return false;
+    }
+
+    height = field->heightAt(lat, lon);
+    if (coarse != nullptr) {
+        *coarse = field->isCoarse();
+    }
+
+    return true;
+}
+
+TerrainHit TerrainQuery::raycast(const TerrainRay& ray) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return raycastLocked(ray);
+}
+
+void TerrainQuery::raycast(const std::vector<TerrainRay>& rays, std::vector<TerrainHit>& hits) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    hits.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i) {
+        hits[i] = raycastLocked(rays[i]);
+    }
+}
+
+TerrainHit TerrainQuery::raycastLocked(const TerrainRay& ray) const
+{
+    TerrainHit result;
+
+    // move the ray into the planet's frame
+    double in[4] = { ray.origin.x, ray.origin.y, ray.origin.z, 1.0 };
+    double out[4];
+    transformVector4DThrough4x4Matrix(in, out, worldToMars.getPtr());
+    const VectorD origin(out[0], out[1], out[2]);
+
+    double inDir[4] = { ray.direction.x, ray.direction.y, ray.direction.z, 0.0 };
+    transformVector4DThrough4x4Matrix(inDir, out, worldToMars.getPtr());
+    VectorD dir(out[0], out[1], out[2]);
+    double dirLength = dir.magnitude();
+    if (dirLength <= 0.0) {
+        return result;
+    }
+    dir = dir / dirLength;
+
+    // signed height above the terrain at a distance along the ray, NaN where no patch is resident
+    auto sample = [this, &origin, &dir](double t, double& step) {
+        VectorD mars2000 = toMars2000FromCartesian(origin + dir * t, marsScale);
+        double altitude = mars2000.z / marsScale;
+
+        const PatchHeightField* field = findField(mars2000.x, mars2000.y);
+        if (field == nullptr) {
+            step = std::max(altitude - MARS_MAX_ELEVATION, 0.0);
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+
+        step = field->getSafeStep(mars2000.x, mars2000.y, altitude);
+        return altitude - field->heightAt(mars2000.x, mars2000.y);
+    };
+
+    const double minStep = MIN_RAY_STEP * MARS_SEMIMAJOR_AXIS * Aftr::DEGtoRADd / (PATCH_RESOLUTION - 1);
+    double prevT = 0.0;
+    double t = 0.0;
+    for (int32_t i = 0; i < MAX_RAY_STEPS && t <= ray.maxDistance; ++i) {
+        double step;
+        double above = sample(t, step);
+
+        if (above <= 0.0) {
+            if (i == 0) {
+                return result; // starts below the terrain
+            }
+
+            // bisect between the last point above the terrain and this one
+            double lo = prevT;
+            double hi = t;
+            for (int32_t j = 0; j < RAY_REFINE_STEPS; ++j) {
+                double mid = (lo + hi) / 2.0;
+                double midStep;
+                double midAbove = sample(mid, midStep);
+                if (midAbove <= 0.0) {
+                    hi = mid;
+                } else {
+                    lo = mid;
+                }
+            }
+
+            VectorD hit = origin + dir * hi;
+            double inHit[4] = { hit.x, hit.y, hit.z, 1.0 };
+            transformVector4DThrough4x4Matrix(inHit, out, marsToWorld.getPtr());
+
+            result.hit = true;
+            result.position = VectorD(out[0], out[1], out[2]);
+            result.distance = (result.position - ray.origin).magnitude();
+            return result;
+        }
+
+        prevT = t;
+        t += std::max(step, minStep) * marsScale;
+    }
+
+    return result;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "AftrOpenGLIncludes.h"
+#include "Mat4.h"
+#include "Vector.h"
+
+namespace Aftr {
+    // elevation of one patch with a min/max quadtree over its cells, immutable once built
+    class PatchHeightField {
+    public:
+        PatchHeightField(uint32_t id, const std::vector<int16_t>& elevation, bool coarse = false);
+
+        uint32_t getId() const { return id; }
+        bool isCoarse() const { return coarse; }
+
+        // bilinear elevation in meters, the coordinate must lie within the patch
+        double heightAt(double lat, double lon) const;
+
+        // distance in meters a point at the given altitude can move without reaching the terrain,
+        // 0 if the point is within the elevation range of its cell
+        double getSafeStep(double lat, double lon, double altitude) const;
+
+    protected:
+        uint32_t id;
+        bool coarse; // built from a coarse tile, replaced once the full tile arrives
+        double north; // latitude of the first row
+        double west; // longitude of the first column
+        std::vector<int16_t> elevation;
+        std::vector<std::vector<int16_t>> minLevels; // level 0 holds one value per cell, each level halves the size
+        std::vector<std::vector<int16_t>> maxLevels;
+
+        void getCellCoords(double lat, double lon, double& u, double& v) const;
+    };
+
+    struct TerrainRay {
+        VectorD origin; // in world space
+        VectorD direction; // in world space, need not be normalized
+        double maxDistance; // in world units
+    };
+
+    struct TerrainHit {
+        bool hit = false;
+        double distance = 0.0; // in world units along the normalized direction
+        VectorD position; // in world space
+    };
+
+    // thread-safe height and ray queries against the elevation of the resident patches
+    class TerrainQuery {
+    public:
+        TerrainQuery(double scale);
+
+        void setWorldTransform(const Mat4D& worldToMars, const Mat4D& marsToWorld);
+        void addPatch(const std::shared_ptr<const PatchHeightField>& field);
+        void removePatch(uint32_t id);
+        size_t getNumPatches() const;
+        std::vector<uint32_t> getPatchIds() const;
+
+        // elevation in meters at a mars2000 coordinate, false if its patch isn't resident
+        bool heightAt(double lat, double lon, double& height, bool* coarse = nullptr) const;
+
+        // first intersection of a ray with the resident terrain
+        TerrainHit raycast(const TerrainRay& ray) const;
+        void raycast(const std::vector<TerrainRay>& rays, std::vector<TerrainHit>& hits) const;
+
+    protected:
+        double marsScale;
+        mutable std::shared_mutex mutex;
+        std::unordered_map<uint32_t, std::shared_ptr<const PatchHeightField>> fields;
+        Mat4D worldToMars;
+        Mat4D marsToWorld;
+
+        const PatchHeightField* findField(double lat, double lon) const;
+        TerrainHit raycastLocked(const TerrainRay& ray) const;
+    };
+}
@@ -0,0 +1,129 @@
+#include "TextureStreamer.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "Constants.h"
+#include "core/ImageMips.h"
+
+using namespace Aftr;
+
+TextureStreamer::TextureStreamer(size_t numSlots, size_t slotBytes)
+    : slotBytes(slotBytes)
+    , buffers(numSlots)
+{
+    glGenBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, slotBytes, nullptr, GL_STREAM_DRAW);
+        freeSlots.push_back(i);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    for (auto& streamed : inFlight) {
+        glDeleteSync(streamed.fence);
+        if (streamed.created) {
+            glDeleteTextures(1, &streamed.texID);
+        }
+    }
+
+    glDeleteBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+}
+
+bool TextureStreamer::hasFreeSlot() const
+{
+    return !freeSlots.empty();
+}
+
+bool TextureStreamer::upload(const std::shared_ptr<Patch>& patch, GLuint texID, const GLubyte* chain, GLuint resolution, GLuint firstLevel, GLuint lastLevel)
+{
+    const size_t firstOffset = MarsCore::getMipOffset(resolution, firstLevel, PATCH_TEXTURE_CHANNELS);
+    const size_t numBytes = MarsCore::getMipOffset(resolution, lastLevel + 1, PATCH_TEXTURE_CHANNELS) - firstOffset;
+    if (freeSlots.empty() || numBytes > slotBytes) {
+        return false;
+    }
+
+    const size_t slot = freeSlots.back();
+
+    // the previous transfer out of this slot has completed (its fence signaled), so the
+    // mapping doesn't need to synchronize with the GPU
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, numBytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst == nullptr) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        std::cerr << "Unable to map texture streaming buffer" << std::endl;
+        return false;
+    }
+    std::memcpy(dst, chain + firstOffset, numBytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    freeSlots.pop_back();
+
+    const bool created = texID == 0;
+    if (created) {
+        glGenTextures(1, &texID);
+        glBindTexture(GL_TEXTURE_2D, texID);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+        // only the transferred levels are defined, sampling is clamped to them
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, firstLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MarsCore::getNumMipLevels(resolution) - 1);
+    } else {
+        // the base level is lowered once the transfer completes
+        glBindTexture(GL_TEXTURE_2D, texID);
+    }
+
+    // sourced from the bound pixel buffer, so this returns without waiting for the transfer
+    for (GLuint level = firstLevel; level <= lastLevel; ++level) {
+        const GLuint levelRes = MarsCore::getMipResolution(resolution, level);
+        const size_t offset = MarsCore::getMipOffset(resolution, level, PATCH_TEXTURE_CHANNELS) - firstOffset;
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levelRes, levelRes,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<const GLvoid*>(offset));
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    StreamedTexture streamed;
+    streamed.patch = patch;
+    streamed.texID = texID;
+    streamed.resolution = resolution;
+    streamed.baseLevel = firstLevel;
+    streamed.created = created;
+    streamed.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    streamed.slot = slot;
+    inFlight.push_back(streamed);
+
+    return true;
+}
+
+std::vector<StreamedTexture> TextureStreamer::collectFinished()
+{
+    std::vector<StreamedTexture> finished;
+
+    while (!inFlight.empty()) {
+        StreamedTexture& streamed = inFlight.front();
+
+        // poll without waiting, fences signal in submission order so stop at the first pending one
+        GLenum status = glClientWaitSync(streamed.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+
+        glDeleteSync(streamed.fence);
+        streamed.fence = nullptr;
+        freeSlots.push_back(streamed.slot);
+
+        finished.push_back(streamed);
+        inFlight.pop_front();
+    }
+
+    return finished;
+}
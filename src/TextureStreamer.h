@@ -0,0 +1,43 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "AftrOpenGLIncludes.h"
+
+namespace Aftr {
+    struct Patch;
+
+    // a patch texture whose data is being transferred from a pixel buffer object
+    struct StreamedTexture {
+        std::weak_ptr<Patch> patch;
+        GLuint texID = 0;
+        GLuint resolution = 0;
+        GLuint baseLevel = 0; // finest level transferred
+        bool created = false; // a new texture rather than finer levels of an existing one
+        GLsync fence = nullptr;
+        size_t slot = 0;
+    };
+
+    // streams patch imagery into textures through a ring of pixel buffer objects, so the render
+    // thread only copies the data and never waits on a transfer. A fence signals when each
+    // transfer is complete and the texture or its new levels can be swapped in.
+    // imagery is passed as a prebuilt RGBA mip chain (see core/ImageMips.h) so levels can be streamed on their own.
+    class TextureStreamer {
+    public:
+        TextureStreamer(size_t numSlots, size_t slotBytes);
+        ~TextureStreamer();
+
+        bool hasFreeSlot() const;
+        // uploads levels firstLevel to lastLevel of the chain, into a new texture if texID is 0
+        bool upload(const std::shared_ptr<Patch>& patch, GLuint texID, const GLubyte* chain, GLuint resolution, GLuint firstLevel, GLuint lastLevel);
+        std::vector<StreamedTexture> collectFinished();
+
+    protected:
+        size_t slotBytes;
+        std::vector<GLuint> buffers;
+        std::vector<size_t> freeSlots;
+        std::deque<StreamedTexture> inFlight; // in submission order, which is also fence signal order
+    };
+}
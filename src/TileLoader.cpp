@@ -0,0 +1,407 @@
+#include "TileLoader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+#include "Constants.h"
+
+using namespace Aftr;
+
+using namespace web::http;
+using namespace web::http::client;
+
+constexpr auto CACHE_POLL_INTERVAL = std::chrono::milliseconds(5); // how often tiles other processes are fetching are checked
+constexpr int64_t NO_CACHE_ENTRY = -1;
+constexpr double LATENCY_SMOOTHING = 0.2; // weight of the newest response time in a mirror's average
+constexpr uint32_t MAX_BACKOFF_DOUBLINGS = 6; // longest backoff is 64 times the first
+constexpr double DOWN_PENALTY = 1e9; // added to the score of a mirror that recently failed
+constexpr double FAILED_PENALTY = 1e12; // added to the score of the mirror a retry failed on
+constexpr double FULL_PENALTY = 1e15; // added to the score of a mirror at its request limit, so it's only used when all are
+
+// the tile doesn't exist, asking again or elsewhere won't help
+class TileMissing : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+TileLoader::TileLoader(const std::vector<std::string>& mirrorUrls, size_t maxInFlight, size_t numDecodeThreads,
+    const RetryPolicy& retryPolicy, std::shared_ptr<SharedTileCache> cache)
+    : state(std::make_shared<State>())
+    , maxInFlight(std::max<size_t>(maxInFlight, 1) * std::max<size_t>(mirrorUrls.size(), 1))
+{
+    state->mirrors.resize(mirrorUrls.size());
+    for (size_t i = 0; i < mirrorUrls.size(); ++i) {
+        state->mirrors[i].url = mirrorUrls[i];
+        state->mirrors[i].client = std::make_unique<http_client>(utility::conversions::to_string_t(mirrorUrls[i]));
+    }
+    state->maxPerMirror = std::max<size_t>(maxInFlight, 1);
+    state->retryPolicy = retryPolicy;
+    state->cache = std::move(cache);
+
+    for (size_t i = 0; i < std::max<size_t>(numDecodeThreads, 1); ++i) {
+        decodeThreads.emplace_back([state = state]() {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(state->mutex);
+                    auto ready = [&state]() { return state->stopped || !state->jobs.empty(); };
+                    if (state->waiting.empty() && state->retries.empty()) {
+                        state->jobReady.wait(lock, ready);
+                    } else {
+                        state->jobReady.wait_for(lock, CACHE_POLL_INTERVAL, ready);
+                    }
+
+                    if (state->stopped) {
+                        return;
+                    }
+
+                    if (!state->jobs.empty()) {
+                        job = std::move(state->jobs.front());
+                        state->jobs.pop_front();
+                    }
+                }
+
+                if (job) {
+                    job();
+                }
+                pollWaiting(state);
+                pollRetries(state);
+            }
+        });
+    }
+}
+
+TileLoader::~TileLoader()
+{
+    shutdown();
+}
+
+void TileLoader::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->stopped) {
+            return;
+        }
+
+        // queued decode jobs are dropped, continuations that finish later find the loader stopped
+        state->stopped = true;
+        state->jobs.clear();
+        state->waiting.clear();
+        state->retries.clear();
+    }
+    state->jobReady.notify_all();
+    state->cancelSource.cancel();
+
+    // decode threads only finish the job they are running, they never wait on the network
+    for (auto& thread : decodeThreads) {
+        thread.join();
+    }
+    decodeThreads.clear();
+}
+
+bool TileLoader::hasCapacity(size_t numRequests) const
+{
+    return state->inFlight.load() + numRequests <= std::max(maxInFlight, numRequests);
+}
+
+size_t TileLoader::getNumInFlight() const
+{
+    return state->inFlight.load();
+}
+
+void TileLoader::fetch(const std::string& endpoint, uint32_t id, GLuint resolution, Callback onLoaded)
+{
+    uri_builder builder(utility::conversions::to_string_t(endpoint));
+    builder.append_query(U("id"), id);
+    if (resolution != PATCH_RESOLUTION) {
+        builder.append_query(U("resolution"), resolution);
+    }
+    const utility::string_t path = builder.to_string();
+
+    state->inFlight++;
+
+    // tiles that were given up on recently fail right away
+    bool failed = false;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        auto found = state->failedUntil.find(path);
+        if (found != state->failedUntil.end()) {
+            if (std::chrono::steady_clock::now() < found->second) {
+                failed = true;
+            } else {
+                state->failedUntil.erase(found);
+            }
+        }
+    }
+    if (failed) {
+        post(state, [state = state, onLoaded]() {
+            onLoaded(nullptr, 0);
+            state->inFlight--;
+        });
+        return;
+    }
+
+    // coarse tiles are a few KB, not worth a slot sized for a full tile
+    if (state->cache == nullptr || resolution != PATCH_RESOLUTION) {
+        request(state, path, onLoaded, NO_CACHE_ENTRY);
+        return;
+    }
+
+    const std::string key = utility::conversions::to_utf8string(path);
+    SharedTileCache::Lookup lookup = state->cache->acquire(key);
+    switch (lookup.status) {
+    case SharedTileCache::Status::Hit: {
+        // published by another process, decoded straight from the shared segment. The entry stays
+        // pinned until the job is done with it, or dropped by a shutdown
+        std::shared_ptr<const unsigned char> data(lookup.data, [cache = state->cache, entry = lookup.entry](const unsigned char*) {
+            cache->release(entry);
+        });
+        post(state, [state = state, data, size = lookup.size, onLoaded]() {
+            onLoaded(data.get(), size);
+            state->inFlight--;
+        });
+        break;
+    }
+    case SharedTileCache::Status::Claimed:
+        request(state, path, onLoaded, lookup.entry);
+        break;
+    case SharedTileCache::Status::Busy: {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->waiting.push_back({ path, key, lookup.entry, onLoaded });
+        break;
+    }
+    case SharedTileCache::Status::Full:
+        request(state, path, onLoaded, NO_CACHE_ENTRY);
+        break;
+    }
+}
+
+void TileLoader::request(const std::shared_ptr<State>& state, const utility::string_t& path, Callback onLoaded, int64_t cacheEntry,
+    uint32_t attempt, size_t failedMirror)
+{
+    const size_t mirror = chooseMirror(state, failedMirror);
+    const auto start = std::chrono::steady_clock::now();
+
+    state->mirrors[mirror].client->request(methods::GET, path, state->cancelSource.get_token())
+        .then([](http_response response) {
+            if (response.status_code() == status_codes::NotFound) {
+                throw TileMissing("Status Code: " + std::to_string(response.status_code()));
+            } else if (response.status_code() != status_codes::OK) {
+                throw std::runtime_error("Status Code: " + std::to_string(response.status_code()));
+            }
+
+            return response.extract_vector();
+        })
+        .then([state, path, onLoaded, cacheEntry, attempt, mirror, start](pplx::task<std::vector<unsigned char>> task) {
+            std::shared_ptr<std::vector<unsigned char>> body;
+            bool canceled = false;
+            bool missing = false;
+            try {
+                body = std::make_shared<std::vector<unsigned char>>(task.get());
+            } catch (const pplx::task_canceled&) {
+                // shutting down
+                canceled = true;
+            } catch (const TileMissing&) {
+                missing = true;
+                std::cerr << "Tile not found: " << state->mirrors[mirror].url << utility::conversions::to_utf8string(path) << std::endl;
+            } catch (const std::exception& e) {
+                std::cerr << "Get request failed: " << state->mirrors[mirror].url << utility::conversions::to_utf8string(path)
+                    << "\n\t" << e.what() << std::endl;
+            }
+
+            // a missing tile is still a response, it says nothing bad about the mirror
+            const double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            const bool answered = body != nullptr || missing;
+            finishRequest(state, mirror, answered ? latencyMs : -1.0, !answered && !canceled);
+
+            if (body == nullptr && !canceled) {
+                fail(state, path, onLoaded, cacheEntry, attempt, mirror, !missing);
+                return;
+            }
+
+            // let the other processes have the tile, or retry it themselves
+            if (cacheEntry != NO_CACHE_ENTRY) {
+                if (body != nullptr) {
+                    state->cache->publish(static_cast<uint32_t>(cacheEntry), body->data(), body->size());
+                } else {
+                    state->cache->abandon(static_cast<uint32_t>(cacheEntry));
+                }
+            }
+
+            // decode off the network threads
+            post(state, [state, body, onLoaded]() {
+                onLoaded(body != nullptr ? body->data() : nullptr, body != nullptr ? body->size() : 0);
+                state->inFlight--;
+            });
+        });
+}
+
+size_t TileLoader::chooseMirror(const std::shared_ptr<State>& state, size_t failedMirror)
+{
+    std::lock_guard<std::mutex> lock(state->mirrorMutex);
+    const auto now = std::chrono::steady_clock::now();
+
+    // the expected wait is the response time times the requests queued ahead, mirrors that haven't
+    // answered yet count as fast so each of them gets measured
+    size_t best = 0;
+    double bestScore = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < state->mirrors.size(); ++i) {
+        const Mirror& mirror = state->mirrors[i];
+        double score = (mirror.latencyMs + 1.0) * (mirror.inFlight + 1);
+        if (now < mirror.downUntil) {
+            score += DOWN_PENALTY;
+        }
+        if (i == failedMirror) {
+            score += FAILED_PENALTY;
+        }
+        if (mirror.inFlight >= state->maxPerMirror) {
+            score += FULL_PENALTY;
+        }
+
+        if (score < bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+
+    state->mirrors[best].inFlight++;
+    return best;
+}
+
+void TileLoader::finishRequest(const std::shared_ptr<State>& state, size_t mirror, double latencyMs, bool failed)
+{
+    std::lock_guard<std::mutex> lock(state->mirrorMutex);
+    Mirror& finished = state->mirrors[mirror];
+    finished.inFlight--;
+
+    if (latencyMs >= 0.0) {
+        finished.latencyMs = finished.latencyMs == 0.0 ? latencyMs : finished.latencyMs + LATENCY_SMOOTHING * (latencyMs - finished.latencyMs);
+    }
+
+    // a failing mirror is avoided for longer each time, until it answers again
+    if (failed) {
+        const double downMs = state->retryPolicy.backoffMs * std::pow(2.0, std::min(finished.failures, MAX_BACKOFF_DOUBLINGS));
+        finished.failures++;
+        finished.downUntil = std::chrono::steady_clock::now() + std::chrono::microseconds(static_cast<int64_t>(downMs * 1000.0));
+    } else {
+        finished.failures = 0;
+    }
+}
+
+void TileLoader::fail(const std::shared_ptr<State>& state, const utility::string_t& path, Callback onLoaded, int64_t cacheEntry,
+    uint32_t attempt, size_t mirror, bool retryable)
+{
+    const RetryPolicy& policy = state->retryPolicy;
+    const auto now = std::chrono::steady_clock::now();
+
+    if (retryable && attempt < policy.maxRetries) {
+        // jittered so retries of a burst of failures don't all land at once
+        thread_local std::default_random_engine gen(std::random_device{}());
+        std::uniform_real_distribution<double> jitter(0.5, 1.5);
+        const double delayMs = policy.backoffMs * std::pow(2.0, std::min(attempt, MAX_BACKOFF_DOUBLINGS)) * jitter(gen);
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->stopped) {
+                return;
+            }
+            state->retries.push_back({ now + std::chrono::microseconds(static_cast<int64_t>(delayMs * 1000.0)),
+                path, onLoaded, cacheEntry, attempt + 1, mirror });
+        }
+        state->jobReady.notify_one(); // so a decode thread starts polling
+        return;
+    }
+
+    // given up, let another process try the tile
+    if (cacheEntry != NO_CACHE_ENTRY) {
+        state->cache->abandon(static_cast<uint32_t>(cacheEntry));
+    }
+
+    if (policy.negativeCacheSec > 0.0) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        for (auto i = state->failedUntil.begin(); i != state->failedUntil.end();) {
+            i = now >= i->second ? state->failedUntil.erase(i) : std::next(i);
+        }
+        state->failedUntil[path] = now + std::chrono::microseconds(static_cast<int64_t>(policy.negativeCacheSec * 1e6));
+    }
+
+    post(state, [state, onLoaded]() {
+        onLoaded(nullptr, 0);
+        state->inFlight--;
+    });
+}
+
+void TileLoader::pollWaiting(const std::shared_ptr<State>& state)
+{
+    std::vector<Waiting> waiting;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        const auto now = std::chrono::steady_clock::now();
+        if (state->waiting.empty() || now - state->lastPoll < CACHE_POLL_INTERVAL) {
+            return;
+        }
+
+        state->lastPoll = now;
+        waiting.swap(state->waiting);
+    }
+
+    std::vector<Waiting> stillWaiting;
+    for (auto& tile : waiting) {
+        SharedTileCache::Lookup lookup = state->cache->check(tile.entry, tile.key);
+        switch (lookup.status) {
+        case SharedTileCache::Status::Hit:
+            tile.onLoaded(lookup.data, lookup.size);
+            state->cache->release(lookup.entry);
+            state->inFlight--;
+            break;
+        case SharedTileCache::Status::Claimed: // the other process failed or went away
+            request(state, tile.path, tile.onLoaded, tile.entry);
+            break;
+        case SharedTileCache::Status::Busy:
+            stillWaiting.push_back(std::move(tile));
+            break;
+        case SharedTileCache::Status::Full:
+            request(state, tile.path, tile.onLoaded, NO_CACHE_ENTRY);
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (!state->stopped) {
+        state->waiting.insert(state->waiting.end(), stillWaiting.begin(), stillWaiting.end());
+    }
+}
+
+void TileLoader::post(const std::shared_ptr<State>& state, std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->stopped) {
+            return;
+        }
+
+        state->jobs.push_back(std::move(job));
+    }
+    state->jobReady.notify_one();
+}
+
+void TileLoader::pollRetries(const std::shared_ptr<State>& state)
+{
+    std::vector<Retry> due;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        const auto now = std::chrono::steady_clock::now();
+        auto waiting = std::partition(state->retries.begin(), state->retries.end(), [&now](const Retry& retry) { return now < retry.due; });
+        due.assign(std::make_move_iterator(waiting), std::make_move_iterator(state->retries.end()));
+        state->retries.erase(waiting, state->retries.end());
+    }
+
+    // on another mirror than the one that failed, if there is one
+    for (auto& retry : due) {
+        request(state, retry.path, retry.onLoaded, retry.cacheEntry, retry.attempt, retry.failedMirror);
+    }
+}
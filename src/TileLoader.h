@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cpprest/http_client.h"
+
+#include "AftrOpenGLIncludes.h"
+#include "SharedTileCache.h"
+
+namespace Aftr {
+    // fetches tiles with non-blocking requests chained through continuations. The number of
+    // requests in flight is limited independently of the core count, responses are handed to a
+    // small pool of decode threads, and shutdown cancels everything without waiting on the network.
+    // with a shared tile cache, full resolution tiles published by other processes are read from it instead.
+    // requests are spread over a list of mirrors by their observed latency and load, failed ones
+    // are retried with exponential backoff on another mirror, and tiles that keep failing are
+    // answered as failed without a request for a while.
+    class TileLoader {
+    public:
+        // called on a decode thread with the response body, or nullptr if the request failed
+        typedef std::function<void(const unsigned char* data, size_t size)> Callback;
+
+        struct RetryPolicy {
+            uint32_t maxRetries; // retries of a failed request before the tile is given up on
+            double backoffMs; // delay before the first retry, doubled for each one after
+            double negativeCacheSec; // how long a given up tile fails without a request (0 disables)
+        };
+
+        // maxInFlight is per mirror, so throughput scales with the number of mirrors. hasCapacity bounds
+        // the total, and each request goes to a mirror below its own limit
+        TileLoader(const std::vector<std::string>& mirrorUrls, size_t maxInFlight, size_t numDecodeThreads,
+            const RetryPolicy& retryPolicy, std::shared_ptr<SharedTileCache> cache = nullptr);
+        ~TileLoader();
+
+        void shutdown();
+
+        bool hasCapacity(size_t numRequests) const;
+        size_t getNumInFlight() const;
+
+        void fetch(const std::string& endpoint, uint32_t id, GLuint resolution, Callback onLoaded);
+
+    protected:
+        // a tile another process is fetching into the shared cache
+        struct Waiting {
+            utility::string_t path;
+            std::string key;
+            uint32_t entry;
+            Callback onLoaded;
+        };
+
+        // a failed request waiting out its backoff
+        struct Retry {
+            std::chrono::steady_clock::time_point due;
+            utility::string_t path;
+            Callback onLoaded;
+            int64_t cacheEntry;
+            uint32_t attempt;
+            size_t failedMirror;
+        };
+
+        // a tile server, its statistics are guarded by the state's mirrorMutex
+        struct Mirror {
+            std::string url;
+            std::unique_ptr<web::http::client::http_client> client;
+            size_t inFlight = 0;
+            double latencyMs = 0.0; // moving average of the response time, 0 until the first response
+            uint32_t failures = 0; // consecutive failed requests
+            std::chrono::steady_clock::time_point downUntil; // avoided after failing, unless all mirrors are
+        };
+
+        // shared with the continuations, which may outlive the loader
+        struct State {
+            std::mutex mutex;
+            std::condition_variable jobReady;
+            std::deque<std::function<void()>> jobs;
+            std::vector<Waiting> waiting;
+            std::vector<Retry> retries;
+            std::unordered_map<utility::string_t, std::chrono::steady_clock::time_point> failedUntil; // negative cache
+            std::chrono::steady_clock::time_point lastPoll;
+            bool stopped = false;
+            std::atomic<size_t> inFlight = 0;
+
+            std::mutex mirrorMutex;
+            std::vector<Mirror> mirrors;
+            size_t maxPerMirror = 1;
+            RetryPolicy retryPolicy;
+            pplx::cancellation_token_source cancelSource;
+            std::shared_ptr<SharedTileCache> cache;
+        };
+
+        std::shared_ptr<State> state;
+        size_t maxInFlight; // total of all mirrors
+        std::vector<std::thread> decodeThreads;
+
+        static void request(const std::shared_ptr<State>& state, const utility::string_t& path, Callback onLoaded, int64_t cacheEntry,
+            uint32_t attempt = 0, size_t failedMirror = std::numeric_limits<size_t>::max());
+        static size_t chooseMirror(const std::shared_ptr<State>& state, size_t failedMirror);
+        static void finishRequest(const std::shared_ptr<State>& state, size_t mirror, double latencyMs, bool failed);
+        static void fail(const std::shared_ptr<State>& state, const utility::string_t& path, Callback onLoaded, int64_t cacheEntry,
+            uint32_t attempt, size_t mirror, bool retryable);
+        static void pollWaiting(const std::shared_ptr<State>& state);
+        static void pollRetries(const std::shared_ptr<State>& state);
+        static void post(const std::shared_ptr<State>& state, std::function<void()> job);
+    };
+}
@@ -1,6 +1,7 @@
 #pragma once
 
-#include "cpprest/http_client.h"
+#include <string>
+#include <vector>
 
 #include "AftrOpenGLIncludes.h"
 #include "Constants.h"
@@ -11,8 +12,11 @@ namespace Aftr {
     VectorD toCartesianFromMars2000(const VectorD& p, double scale);
     uint32_t getPatchIndexFromMars2000(const VectorD& p);
     VectorD getMars2000FromPatchIndex(uint32_t index);
+    VectorD getLowerRightMars2000FromPatchIndex(uint32_t index);
 
-    bool makeGetRequest(const std::string base_uri, web::http::uri_builder& uri, std::vector<unsigned char>& result);
-    bool loadElevation(uint32_t index, std::vector<int16_t>& data);
-    bool loadImagery(uint32_t index, std::vector<GLubyte>& data);
+    double getConfigDouble(const std::string& name, double defaultValue);
+
+    bool decodeElevation(uint32_t index, const unsigned char* bytes, size_t size, GLuint resolution, std::vector<int16_t>& data);
+    bool decodeImagery(uint32_t index, const unsigned char* bytes, size_t size, GLuint resolution, std::vector<GLubyte>& data, GLuint channels = 3);
+    void resampleElevation(const std::vector<int16_t>& src, GLuint srcResolution, std::vector<int16_t>& dst, GLuint dstResolution);
 };
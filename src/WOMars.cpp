@@ -1,7 +1,9 @@
 #include "WOMars.h"
 
+#include <algorithm>
 #include <cmath>
 
+#include "Camera.h"
 #include "Constants.h"
 #include "MGLMars.h"
 #include "Utils.h"
@@ -26,25 +28,24 @@ WOMars* WOMars::New(const Camera** cam, double scale)
 
 WOMars* WOMars::New(const Camera** cam, const VectorD& reference, double scale)
 {
-    // calculate elevation at given reference point
-    uint32_t index = getPatchIndexFromMars2000(reference);
-    std::vector<int16_t> elev;
-    bool success = loadElevation(index, elev);
-
-    VectorD loc = reference;
-    if (success) {
-        double percentX = loc.y - std::floor(loc.y);
-        double percentY = std::ceil(loc.x) - loc.x;
-        GLuint x = static_cast<GLuint>(percentX * PATCH_RESOLUTION);
-        x = std::min(x, PATCH_RESOLUTION);
-        GLuint y = static_cast<GLuint>(percentY * PATCH_RESOLUTION);
-        y = std::min(y, PATCH_RESOLUTION);
-
-        loc.z += elev[x + y * PATCH_RESOLUTION];
-    } else {
-        std::cerr << "WARNING: Unable to load elevation data at reference point, using given value instead." << std::endl;
-    }
+    // place the reference frame at the given elevation for now, it is refined once the terrain
+    // under it arrives so startup never waits on the tile server
+    Mat4D ref = getReferenceMatrix(reference, scale);
+
+    WOMars* wo = new WOMars();
+    wo->onCreate(cam, scale, ref);
+    wo->refiningReference = true;
+    wo->referenceLoc = reference;
+    Aftr::aftrGluInvertMatrix(ref.getPtr(), wo->referenceInv.getPtr());
+
+    // start fetching the patches around the start location right away
+    wo->getModelT<MGLMars>()->prefetch(getPatchIndexFromMars2000(reference));
+
+    return wo;
+}
 
+Mat4D WOMars::getReferenceMatrix(const VectorD& loc, double scale)
+{
     // calculate reference matrix from given mars2000 coordinate
     VectorD pos = toCartesianFromMars2000(loc, scale);
     VectorD z = pos.normalizeMe();
@@ -73,28 +74,136 @@ WOMars* WOMars::New(const Camera** cam, const VectorD& reference, double scale)
 
     ref = ref.translate(VectorD(0, 0, pos.magnitude()));
 
-    WOMars* wo = new WOMars();
-    wo->onCreate(cam, scale, ref);
-
-    return wo;
+    return ref;
 }
 
 WOMars::WOMars()
     : IFace(this)
     , WO()
 {
-    camPtrPtr = nullptr;
+    marsScale = 1.0;
+    refiningReference = false;
 }
 
 void WOMars::onUpdateWO()
 {
-    if (camPtrPtr != nullptr) {
-        getModelT<MGLMars>()->update(**camPtrPtr);
+    if (refiningReference) {
+        refineReference();
+    }
+
+    std::vector<const Camera*> cameras;
+    cameras.reserve(camPtrPtrs.size());
+    for (const Camera** cam : camPtrPtrs) {
+        cameras.push_back(cam != nullptr ? *cam : nullptr);
+    }
+    getModelT<MGLMars>()->update(cameras);
+}
+
+size_t WOMars::addView(const Camera** cam)
+{
+    camPtrPtrs.push_back(cam);
+    return getModelT<MGLMars>()->addView();
+}
+
+void WOMars::removeView(const Camera** cam)
+{
+    // the first view stays, it may be prefetching
+    auto found = std::find(camPtrPtrs.begin() + 1, camPtrPtrs.end(), cam);
+    if (found != camPtrPtrs.end()) {
+        getModelT<MGLMars>()->removeView(found - camPtrPtrs.begin());
+        camPtrPtrs.erase(found);
+    }
+}
+
+void WOMars::refineReference()
+{
+    double height;
+    bool coarse;
+    if (!terrainQuery->heightAt(referenceLoc.x, referenceLoc.y, height, &coarse)) {
+        return;
     }
+
+    // where the reference point on the terrain lies in the original reference frame
+    VectorD loc = referenceLoc;
+    loc.z += height;
+    VectorD pos = toCartesianFromMars2000(loc, marsScale);
+    double in[4] = { pos.x, pos.y, pos.z, 1.0 };
+    double out[4];
+    transformVector4DThrough4x4Matrix(in, out, referenceInv.getPtr());
+    VectorD offset(out[0], out[1], out[2]);
+
+    // shift the model so the refined reference point sits where the original one was
+    Vector position = getPosition();
+    position.x += static_cast<float>(referenceOffset.x - offset.x);
+    position.y += static_cast<float>(referenceOffset.y - offset.y);
+    position.z += static_cast<float>(referenceOffset.z - offset.z);
+    setPosition(position);
+    referenceOffset = offset;
+
+    // a coarse height is refined again once the full tile arrives
+    refiningReference = coarse;
+}
+
+bool WOMars::isViewComplete(size_t view) const
+{
+    return static_cast<const MGLMars*>(model)->isViewComplete(view);
+}
+
+VectorD WOMars::getWorldFromMars2000(const VectorD& loc) const
+{
+    return static_cast<const MGLMars*>(model)->getWorldFromMars2000(loc);
+}
+
+bool WOMars::heightAt(double lat, double lon, double& height) const
+{
+    return terrainQuery->heightAt(lat, lon, height);
+}
+
+TerrainHit WOMars::raycast(const TerrainRay& ray) const
+{
+    return terrainQuery->raycast(ray);
+}
+
+void WOMars::raycast(const std::vector<TerrainRay>& rays, std::vector<TerrainHit>& hits) const
+{
+    terrainQuery->raycast(rays, hits);
+}
+
+TerrainHit WOMars::pick(const Camera& cam, double x, double y) const
+{
+    // the ray from the near to the far plane through the point
+    Mat4D viewProjInv;
+    aftrGluInvertMatrix((cam.getCameraProjectionMatrix().toMatD() * cam.getCameraViewMatrix().toMatD()).getPtr(), viewProjInv.getPtr());
+    double nearIn[4] = { x, y, -1.0, 1.0 };
+    double farIn[4] = { x, y, 1.0, 1.0 };
+    double nearOut[4];
+    double farOut[4];
+    transformVector4DThrough4x4Matrix(nearIn, nearOut, viewProjInv.getPtr());
+    transformVector4DThrough4x4Matrix(farIn, farOut, viewProjInv.getPtr());
+
+    TerrainRay ray;
+    ray.origin = VectorD(nearOut[0], nearOut[1], nearOut[2]) / nearOut[3];
+    ray.direction = VectorD(farOut[0], farOut[1], farOut[2]) / farOut[3] - ray.origin;
+    ray.maxDistance = ray.direction.magnitude();
+
+    return terrainQuery->raycast(ray);
+}
+
+#ifdef AFTR_CONFIG_USE_ODE
+dSpaceID WOMars::getCollisionSpace() const
+{
+    return terrainCollider != nullptr ? terrainCollider->getSpace() : nullptr;
 }
+#endif
 
 void WOMars::onCreate(const Camera** cam, double scale, const Mat4D& reference)
 {
-    camPtrPtr = cam;
-    model = new MGLMars(this, scale, reference);
+    camPtrPtrs.assign(1, cam);
+    marsScale = scale;
+    MGLMars* mgl = new MGLMars(this, scale, reference);
+    terrainQuery = mgl->getTerrainQuery();
+#ifdef AFTR_CONFIG_USE_ODE
+    terrainCollider = mgl->getTerrainCollider();
+#endif
+    model = mgl;
 }
\ No newline at end of file
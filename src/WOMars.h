@@ -1,8 +1,13 @@
 #pragma once
 
+#include <vector>
+
 #include "Mat4.h"
 #include "WO.h"
 
+#include "TerrainCollider.h"
+#include "TerrainQuery.h"
+
 namespace Aftr {
     class WOMars : public WO {
     public:
@@ -12,10 +17,45 @@ namespace Aftr {
 
         void onUpdateWO() override;
 
+        // additional cameras rendering the terrain (e.g. other viewports), they share the loaded
+        // patches and their GPU buffers and textures but each gets its own visible set
+        size_t addView(const Camera** cam);
+        void removeView(const Camera** cam);
+        bool isViewComplete(size_t view = 0) const;
+
+        // world position of a mars2000 coordinate (latitude, longitude, elevation in meters)
+        VectorD getWorldFromMars2000(const VectorD& loc) const;
+
+        // thread-safe queries against the resident terrain (see TerrainQuery)
+        bool heightAt(double lat, double lon, double& height) const;
+        TerrainHit raycast(const TerrainRay& ray) const;
+        void raycast(const std::vector<TerrainRay>& rays, std::vector<TerrainHit>& hits) const;
+        // the terrain under a point of the camera's view, x and y in normalized device coordinates (-1 to 1)
+        TerrainHit pick(const Camera& cam, double x, double y) const;
+
+#ifdef AFTR_CONFIG_USE_ODE
+        // space of the terrain heightfields, collide bodies against it with dSpaceCollide2
+        // (null if marsTerrainCollision is disabled)
+        dSpaceID getCollisionSpace() const;
+#endif
+
     protected:
-        const Camera** camPtrPtr;
+        std::vector<const Camera**> camPtrPtrs; // one per view, the first is the one the terrain was created with
+        std::shared_ptr<TerrainQuery> terrainQuery;
+#ifdef AFTR_CONFIG_USE_ODE
+        std::shared_ptr<TerrainCollider> terrainCollider;
+#endif
+
+        double marsScale;
+        bool refiningReference; // waiting on (full) elevation at the reference point
+        VectorD referenceLoc; // mars2000 coordinate the reference frame was created at
+        Mat4D referenceInv;
+        VectorD referenceOffset; // position of the refined reference point in the original reference frame
 
         WOMars();
         void onCreate(const Camera** cam, double scale, const Mat4D& reference);
+        void refineReference();
+
+        static Mat4D getReferenceMatrix(const VectorD& loc, double scale);
     };
 }
\ No newline at end of file
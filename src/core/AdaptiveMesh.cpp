@@ -0,0 +1,159 @@
+#include "AdaptiveMesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "MarsConstants.h"
+
+using namespace MarsCore;
+
+constexpr uint32_t TILE_SIZE = PATCH_RESOLUTION; // cells along each side of the virtual grid, must be a power of 2
+constexpr uint32_t GRID_SIZE = TILE_SIZE + 1;
+constexpr uint32_t NUM_TRIANGLES = TILE_SIZE * TILE_SIZE * 2 - 2; // every triangle of the hierarchy but the two roots' parents
+constexpr uint32_t NUM_PARENT_TRIANGLES = NUM_TRIANGLES - TILE_SIZE * TILE_SIZE;
+
+// hypotenuse endpoints of every triangle in the hierarchy, shared by all patches
+static const std::vector<uint16_t>& getTriangleCoords()
+{
+    static const std::vector<uint16_t> coords = []() {
+        std::vector<uint16_t> coords(NUM_TRIANGLES * 4);
+        for (uint32_t i = 0; i < NUM_TRIANGLES; ++i) {
+            // the bits of the id walk down the hierarchy from one of the two root triangles
+            uint32_t id = i + 2;
+            uint32_t ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+            if (id & 1) {
+                bx = by = cx = TILE_SIZE;
+            } else {
+                ax = ay = cy = TILE_SIZE;
+            }
+
+            while ((id >>= 1) > 1) {
+                uint32_t mx = (ax + bx) >> 1;
+                uint32_t my = (ay + by) >> 1;
+                if (id & 1) { // left child
+                    bx = ax; by = ay;
+                    ax = cx; ay = cy;
+                } else { // right child
+                    ax = bx; ay = by;
+                    bx = cx; by = cy;
+                }
+                cx = mx;
+                cy = my;
+            }
+
+            coords[i * 4 + 0] = static_cast<uint16_t>(ax);
+            coords[i * 4 + 1] = static_cast<uint16_t>(ay);
+            coords[i * 4 + 2] = static_cast<uint16_t>(bx);
+            coords[i * 4 + 3] = static_cast<uint16_t>(by);
+        }
+        return coords;
+    }();
+
+    return coords;
+}
+
+AdaptiveMesh::AdaptiveMesh(const std::vector<int16_t>& elevation)
+    : errors(GRID_SIZE * GRID_SIZE, 0.0f)
+{
+    auto height = [&elevation](uint32_t x, uint32_t y) {
+        return static_cast<float>(elevation[std::min(x, PATCH_RESOLUTION - 1) + std::min(y, PATCH_RESOLUTION - 1) * PATCH_RESOLUTION]);
+    };
+
+    // border vertices are always split in, the virtual row and column as well as the real last ones
+    const float forced = std::numeric_limits<float>::infinity();
+    for (uint32_t i = 0; i < GRID_SIZE; ++i) {
+        for (uint32_t edge : { 0u, PATCH_RESOLUTION - 1, TILE_SIZE }) {
+            errors[i + edge * GRID_SIZE] = forced;
+            errors[edge + i * GRID_SIZE] = forced;
+        }
+    }
+
+    // walk the hierarchy bottom up so each vertex also carries the errors of the triangles it depends on
+    const std::vector<uint16_t>& coords = getTriangleCoords();
+    for (uint32_t i = NUM_TRIANGLES; i-- > 0;) {
+        uint32_t ax = coords[i * 4 + 0];
+        uint32_t ay = coords[i * 4 + 1];
+        uint32_t bx = coords[i * 4 + 2];
+        uint32_t by = coords[i * 4 + 3];
+        uint32_t mx = (ax + bx) >> 1;
+        uint32_t my = (ay + by) >> 1;
+        uint32_t cx = mx + my - ay;
+        uint32_t cy = my + ax - mx;
+
+        float interpolated = (height(ax, ay) + height(bx, by)) / 2.0f;
+        float& middle = errors[mx + my * GRID_SIZE];
+        middle = std::max(middle, std::abs(interpolated - height(mx, my)));
+
+        if (i < NUM_PARENT_TRIANGLES) {
+            float left = errors[((ax + cx) >> 1) + ((ay + cy) >> 1) * GRID_SIZE];
+            float right = errors[((bx + cx) >> 1) + ((by + cy) >> 1) * GRID_SIZE];
+            middle = std::max({ middle, left, right });
+        }
+    }
+}
+
+template <typename Emit>
+void AdaptiveMesh::extract(float maxError, Emit&& emit) const
+{
+    struct Triangle {
+        uint32_t ax, ay, bx, by, cx, cy;
+    };
+
+    // depth first with an explicit stack, the hierarchy is at most 2 * log2(TILE_SIZE) levels deep
+    Triangle stack[64];
+    size_t top = 0;
+    stack[top++] = { 0, 0, TILE_SIZE, TILE_SIZE, TILE_SIZE, 0 };
+    stack[top++] = { TILE_SIZE, TILE_SIZE, 0, 0, 0, TILE_SIZE };
+
+    while (top > 0) {
+        const Triangle t = stack[--top];
+        uint32_t mx = (t.ax + t.bx) >> 1;
+        uint32_t my = (t.ay + t.by) >> 1;
+
+        const uint32_t legLength = (t.ax > t.cx ? t.ax - t.cx : t.cx - t.ax) + (t.ay > t.cy ? t.ay - t.cy : t.cy - t.ay);
+        if (legLength > 1 && errors[mx + my * GRID_SIZE] > maxError) {
+            stack[top++] = { t.bx, t.by, t.cx, t.cy, mx, my };
+            stack[top++] = { t.cx, t.cy, t.ax, t.ay, mx, my };
+            continue;
+        }
+
+        uint32_t ax = std::min(t.ax, PATCH_RESOLUTION - 1), ay = std::min(t.ay, PATCH_RESOLUTION - 1);
+        uint32_t bx = std::min(t.bx, PATCH_RESOLUTION - 1), by = std::min(t.by, PATCH_RESOLUTION - 1);
+        uint32_t cx = std::min(t.cx, PATCH_RESOLUTION - 1), cy = std::min(t.cy, PATCH_RESOLUTION - 1);
+
+        // skip triangles collapsed by the clamping, and match the winding of the uniform grid
+        int64_t cross = (static_cast<int64_t>(bx) - ax) * (static_cast<int64_t>(cy) - ay)
+            - (static_cast<int64_t>(by) - ay) * (static_cast<int64_t>(cx) - ax);
+        if (cross == 0) {
+            continue;
+        } else if (cross > 0) {
+            std::swap(bx, cx);
+            std::swap(by, cy);
+        }
+
+        emit(ax + ay * PATCH_RESOLUTION, bx + by * PATCH_RESOLUTION, cx + cy * PATCH_RESOLUTION);
+    }
+}
+
+uint32_t AdaptiveMesh::generateIndices(uint32_t* indexPtr, uint32_t baseVertIndex, float maxError) const
+{
+    const uint32_t* start = indexPtr;
+
+    extract(maxError, [&indexPtr, baseVertIndex](uint32_t a, uint32_t b, uint32_t c) {
+        indexPtr[0] = a + baseVertIndex;
+        indexPtr[1] = b + baseVertIndex;
+        indexPtr[2] = c + baseVertIndex;
+        indexPtr += 3;
+    });
+
+    return static_cast<uint32_t>(indexPtr - start);
+}
+
+uint32_t AdaptiveMesh::countTriangles(float maxError) const
+{
+    uint32_t count = 0;
+    extract(maxError, [&count](uint32_t, uint32_t, uint32_t) { ++count; });
+
+    return count;
+}
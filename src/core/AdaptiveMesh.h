@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace MarsCore {
+    // error-bounded triangulation of a patch's elevation grid as a right-triangulated irregular network.
+    // the grid is treated as PATCH_RESOLUTION + 1 vertices wide with the extra row and column clamped onto
+    // the last one, and every border vertex is kept so patches line up with neighbors of any mesh.
+    class AdaptiveMesh {
+    public:
+        explicit AdaptiveMesh(const std::vector<int16_t>& elevation);
+
+        // writes the triangles of the mesh whose error measured at the split vertices stays within maxError
+        // (meters), returns the index count
+        uint32_t generateIndices(uint32_t* indexPtr, uint32_t baseVertIndex, float maxError) const;
+        uint32_t countTriangles(float maxError) const;
+
+    protected:
+        std::vector<float> errors; // largest error of the triangles split at each vertex of the virtual grid
+
+        template <typename Emit>
+        void extract(float maxError, Emit&& emit) const;
+    };
+}
@@ -0,0 +1,107 @@
+#include "ImageMips.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MARS_CORE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace MarsCore;
+
+uint32_t MarsCore::getNumMipLevels(uint32_t resolution)
+{
+    uint32_t levels = 1;
+    while (resolution > 1) {
+        resolution /= 2;
+        ++levels;
+    }
+
+    return levels;
+}
+
+uint32_t MarsCore::getMipResolution(uint32_t resolution, uint32_t level)
+{
+    return std::max(resolution >> level, 1u);
+}
+
+size_t MarsCore::getMipOffset(uint32_t resolution, uint32_t level, uint32_t channels)
+{
+    size_t offset = 0;
+    for (uint32_t i = 0; i < level; ++i) {
+        size_t res = getMipResolution(resolution, i);
+        offset += res * res * channels;
+    }
+
+    return offset;
+}
+
+// averages 2x2 texels of one row pair, rounded, from texel x of the destination row on
+static void downsampleRow(const uint8_t* row0, const uint8_t* row1, uint32_t srcRes, uint8_t* dst, uint32_t x, uint32_t dstRes, uint32_t channels)
+{
+    for (; x < dstRes; ++x) {
+        // odd sizes only occur for non power of 2 tiles, the last row and column are repeated
+        const uint32_t x0 = std::min(x * 2, srcRes - 1) * channels;
+        const uint32_t x1 = std::min(x * 2 + 1, srcRes - 1) * channels;
+        for (uint32_t c = 0; c < channels; ++c) {
+            uint32_t sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+            dst[x * channels + c] = static_cast<uint8_t>((sum + 2) / 4);
+        }
+    }
+}
+
+#ifdef MARS_CORE_SSE2
+// RGBA rows of an even width, two destination texels per step, same rounding as downsampleRow
+static uint32_t downsampleRowRGBA(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dstRes)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+
+    uint32_t x = 0;
+    for (; x + 2 <= dstRes; x += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+
+        // widen to 16 bits and add the rows, each half holds two source texels
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+        // add the neighboring texels, then gather both sums into one register
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i sum = _mm_unpacklo_epi64(lo, hi);
+
+        __m128i avg = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 4), _mm_packus_epi16(avg, zero));
+    }
+
+    return x;
+}
+#endif
+
+void MarsCore::buildMipChain(std::vector<uint8_t>& chain, uint32_t resolution, uint32_t channels)
+{
+    const uint32_t levels = getNumMipLevels(resolution);
+    chain.resize(getMipOffset(resolution, levels, channels));
+
+    for (uint32_t level = 1; level < levels; ++level) {
+        const uint32_t srcRes = getMipResolution(resolution, level - 1);
+        const uint32_t dstRes = getMipResolution(resolution, level);
+        const uint8_t* src = &chain[getMipOffset(resolution, level - 1, channels)];
+        uint8_t* dst = &chain[getMipOffset(resolution, level, channels)];
+
+        for (uint32_t y = 0; y < dstRes; ++y) {
+            const uint8_t* row0 = src + std::min(y * 2, srcRes - 1) * srcRes * channels;
+            const uint8_t* row1 = src + std::min(y * 2 + 1, srcRes - 1) * srcRes * channels;
+            uint8_t* dstRow = dst + y * dstRes * channels;
+
+            uint32_t x = 0;
+#ifdef MARS_CORE_SSE2
+            if (channels == 4 && srcRes % 2 == 0) {
+                x = downsampleRowRGBA(row0, row1, dstRow, dstRes);
+            }
+#endif
+            downsampleRow(row0, row1, srcRes, dstRow, x, dstRes, channels);
+        }
+    }
+}
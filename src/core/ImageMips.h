@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MarsCore {
+    // mip chains are stored level after level, finest first, each level tightly packed
+    uint32_t getNumMipLevels(uint32_t resolution);
+    size_t getMipOffset(uint32_t resolution, uint32_t level, uint32_t channels);
+    uint32_t getMipResolution(uint32_t resolution, uint32_t level);
+
+    // fills in every level after the first with a 2x2 box filter, resizing the chain to hold them
+    void buildMipChain(std::vector<uint8_t>& chain, uint32_t resolution, uint32_t channels);
+};
@@ -0,0 +1,157 @@
+#include "Mars2000.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "MarsConstants.h"
+
+using namespace MarsCore;
+
+constexpr double PI = 3.14159265358979323846;
+constexpr double DEG_TO_RAD = PI / 180.0;
+constexpr double RAD_TO_DEG = 180.0 / PI;
+
+Vec3d MarsCore::toMars2000FromCartesian(const Vec3d& p, double scale)
+{
+    double a, f, b, e2, ep2, r2, r, E2, F, G, c, s, P, Q, ro, tmp, U, V, zo, h, phi, lambda;
+    double Z = p.z;
+    double X = p.x;
+    double Y = p.y;
+    //phi - latitude
+    //lamba - longitude
+    //h - elevation
+
+    a = MARS_SEMIMAJOR_AXIS * scale;
+    f = MARS_RECIPROCAL_FLATTENING;
+    b = a * (1 - f); // semi-minor axis (3376200 meters)
+
+    e2 = 2 * f - f * f;// first eccentricity squared
+    ep2 = f * (2 - f) / (std::pow((1 - f), 2.0f)); // second eccentricity squared
+
+    r2 = X * X + Y * Y;
+    r = std::sqrt(r2);
+    E2 = a * a - b * b;
+    F = 54 * b * b * Z * Z;
+    G = r2 + (1 - e2) * Z * Z - e2 * E2;
+    c = (e2 * e2 * F * r2) / (G * G * G);
+    s = std::pow(1 + c + std::sqrt(c * c + 2 * c), (1.0 / 3.0));
+    P = F / (3 * std::pow(s + 1 / s + 1, 2.0f) * G * G);
+    Q = std::sqrt(1 + 2 * e2 * e2 * P);
+    ro = -(e2 * P * r) / (1 + Q) + std::sqrt((a * a / 2) * (1 + 1 / Q) - ((1 - e2) * P * Z * Z) / (Q * (1 + Q)) - P * r2 / 2);
+    tmp = std::pow(r - e2 * ro, 2.0f);
+    U = std::sqrt(tmp + Z * Z);
+    V = std::sqrt(tmp + (1 - e2) * Z * Z);
+    zo = (b * b * Z) / (a * V);
+
+    h = U * (1 - (b * b) / (a * V));
+    phi = std::atan2(Z + ep2 * zo, r);
+    lambda = std::atan2(Y, X);
+
+    phi *= RAD_TO_DEG;
+    lambda *= RAD_TO_DEG;
+
+    return { phi, lambda, h };
+}
+
+Vec3d MarsCore::toCartesianFromMars2000(const Vec3d& p, double scale)
+{
+    double a = MARS_SEMIMAJOR_AXIS * scale;
+    double e2 = 2 * MARS_RECIPROCAL_FLATTENING - MARS_RECIPROCAL_FLATTENING * MARS_RECIPROCAL_FLATTENING;
+    double elev = p.z * scale;
+
+    double latRad = p.x * DEG_TO_RAD;
+    double lonRad = p.y * DEG_TO_RAD;
+
+    double sinLatRad = std::sin(latRad);
+    double e2sinLatSq = e2 * (sinLatRad * sinLatRad);
+
+    double rn = a / std::sqrt(1 - e2sinLatSq);
+    double R = (rn + elev) * std::cos(latRad);
+
+    Vec3d cartVec;
+    cartVec.x = R * std::cos(lonRad);
+    cartVec.y = R * std::sin(lonRad);
+    cartVec.z = (rn * (1 - e2) + elev) * std::sin(latRad);
+
+    return cartVec;
+}
+
+uint32_t MarsCore::getPatchIndexFromMars2000(const Vec3d& p)
+{
+    uint32_t x = static_cast<uint32_t>(p.y + 180.0);
+    uint32_t y = static_cast<uint32_t>(90.0 - p.x);
+
+    // the east edge and south pole belong to the last patch in each direction
+    x = std::min(x, PATCH_GRID_WIDTH - 1);
+    y = std::min(y, PATCH_GRID_HEIGHT - 1);
+
+    return x + y * PATCH_GRID_WIDTH;
+}
+
+Vec3d MarsCore::getMars2000FromPatchIndex(uint32_t index)
+{
+    uint32_t x = index % PATCH_GRID_WIDTH;
+    uint32_t y = index / PATCH_GRID_WIDTH;
+    double theta = static_cast<double>(x) - 180.0;
+    double phi = 90.0 - static_cast<double>(y);
+
+    return { phi, theta, 0.0 };
+}
+
+Vec3d MarsCore::getLowerRightMars2000FromPatchIndex(uint32_t index)
+{
+    Vec3d ul = getMars2000FromPatchIndex(index);
+    return { ul.x - 180.0 / PATCH_GRID_HEIGHT, ul.y + 360.0 / PATCH_GRID_WIDTH, 0.0 };
+}
+
+uint32_t MarsCore::getNeighborPatchIndex(uint32_t x, uint32_t y, int32_t dx, int32_t dy)
+{
+    int32_t patchX = static_cast<int32_t>(x) + dx;
+    int32_t patchY = static_cast<int32_t>(y) + dy;
+
+    // crossing a pole continues down the meridian on the opposite side
+    if (patchY < 0) {
+        patchY = -patchY - 1;
+        patchX += PATCH_GRID_WIDTH / 2;
+    } else if (patchY >= static_cast<int32_t>(PATCH_GRID_HEIGHT)) {
+        patchY = 2 * PATCH_GRID_HEIGHT - patchY - 1;
+        patchX += PATCH_GRID_WIDTH / 2;
+    }
+    patchY = std::clamp(patchY, 0, static_cast<int32_t>(PATCH_GRID_HEIGHT) - 1);
+
+    // longitude wraps around
+    const int32_t width = static_cast<int32_t>(PATCH_GRID_WIDTH);
+    patchX = ((patchX % width) + width) % width;
+
+    return static_cast<uint32_t>(patchX) + static_cast<uint32_t>(patchY) * PATCH_GRID_WIDTH;
+}
+
+void MarsCore::getPatchRings(uint32_t center, int32_t radius, double maxWidening, std::vector<std::pair<uint32_t, int32_t>>& rings)
+{
+    const uint32_t centerX = center % PATCH_GRID_WIDTH;
+    const uint32_t centerY = center / PATCH_GRID_WIDTH;
+    rings.clear();
+
+    std::unordered_map<uint32_t, size_t> entries;
+    for (int32_t y = -radius; y <= radius; ++y) {
+        const uint32_t row = getNeighborPatchIndex(centerX, centerY, 0, y) / PATCH_GRID_WIDTH;
+        const double lat = 90.0 - (row + 0.5) * (180.0 / PATCH_GRID_HEIGHT);
+        const double widening = std::min(1.0 / std::cos(lat * DEG_TO_RAD), maxWidening);
+        const int32_t halfWidth = std::min(static_cast<int32_t>(std::lround(radius * widening)), static_cast<int32_t>(PATCH_GRID_WIDTH / 2));
+
+        for (int32_t x = -halfWidth; x <= halfWidth; ++x) {
+            const uint32_t index = getNeighborPatchIndex(centerX, centerY, x, y);
+            const int32_t ring = std::min(std::max(std::abs(y), static_cast<int32_t>(std::ceil(std::abs(x) / widening))), radius);
+
+            // rows wrap onto each other around and across the poles, keep the closest ring
+            auto seen = entries.find(index);
+            if (seen != entries.end()) {
+                rings[seen->second].second = std::min(rings[seen->second].second, ring);
+                continue;
+            }
+            entries[index] = rings.size();
+            rings.emplace_back(index, ring);
+        }
+    }
+}
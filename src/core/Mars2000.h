@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace MarsCore {
+    struct Vec3d {
+        double x = 0.0;
+        double y = 0.0;
+        double z = 0.0;
+    };
+
+    // Mars 2000 coordinates are (latitude, longitude, elevation) in degrees and meters
+    Vec3d toMars2000FromCartesian(const Vec3d& p, double scale);
+    Vec3d toCartesianFromMars2000(const Vec3d& p, double scale);
+    uint32_t getPatchIndexFromMars2000(const Vec3d& p);
+    Vec3d getMars2000FromPatchIndex(uint32_t index);
+    // south east corner of a patch, the patch index of the next row and column wraps around the grid instead
+    Vec3d getLowerRightMars2000FromPatchIndex(uint32_t index);
+    // index of the patch dx columns and dy rows from patch (x, y), crossing the poles and wrapping around in longitude
+    uint32_t getNeighborPatchIndex(uint32_t x, uint32_t y, int32_t dx, int32_t dy);
+    // the patches within radius rows of the center patch, each with its ring (distance from the center). Rows
+    // reach across the poles and are widened along longitude by 1/cos(latitude), up to maxWidening, since
+    // patches narrow towards the poles. Each patch is listed once, with its closest ring
+    void getPatchRings(uint32_t center, int32_t radius, double maxWidening, std::vector<std::pair<uint32_t, int32_t>>& rings);
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+namespace MarsCore {
+    constexpr uint32_t PATCH_RESOLUTION = 256; // square resolution of imagery and elevation tiles from the database
+    constexpr uint32_t PATCH_GRID_WIDTH = 360; // number of one degree patches along longitude
+    constexpr uint32_t PATCH_GRID_HEIGHT = 180; // number of one degree patches along latitude
+    constexpr uint32_t NUM_PATCHES = PATCH_GRID_WIDTH * PATCH_GRID_HEIGHT; // total number of patches covering the planet
+    constexpr double MARS_SEMIMAJOR_AXIS = 3396190.0; // in meters
+    constexpr double MARS_RECIPROCAL_FLATTENING = 0.0058860075555254854;
+
+    // derived constants
+    constexpr uint32_t NUM_VERTS_PER_PATCH = PATCH_RESOLUTION * PATCH_RESOLUTION;
+    constexpr uint32_t NUM_TRIS_PER_PATCH = (PATCH_RESOLUTION - 1) * (PATCH_RESOLUTION - 1) * 2;
+};
@@ -0,0 +1,153 @@
+#include "PatchMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "MarsConstants.h"
+
+using namespace MarsCore;
+
+constexpr double PI = 3.14159265358979323846;
+constexpr uint32_t MAX_LONGITUDE_DETAIL = 8; // a stride of the whole patch
+
+uint32_t MarsCore::getLongitudeDetail(uint32_t patchIndex)
+{
+    // the patch is widest on its edge closest to the equator
+    const uint32_t y = patchIndex / PATCH_GRID_WIDTH;
+    const double north = 90.0 - static_cast<double>(y);
+    const double south = north - 180.0 / PATCH_GRID_HEIGHT;
+    const double lat = std::min(std::abs(north), std::abs(south));
+
+    // one level for every halving of the width against the equator
+    const double width = std::cos(lat * PI / 180.0);
+    uint32_t lonDetail = 0;
+    while (lonDetail < MAX_LONGITUDE_DETAIL && width * (2u << lonDetail) <= 1.0) {
+        ++lonDetail;
+    }
+
+    return lonDetail;
+}
+
+uint32_t MarsCore::generateGridIndices(uint32_t* indexPtr, uint32_t baseVertIndex, uint32_t detail, uint32_t lonDetail)
+{
+    const uint32_t width = PATCH_RESOLUTION;
+    const uint32_t* start = indexPtr;
+
+    if (detail == 0 && lonDetail == 0) {
+        for (uint32_t y = 0; y < PATCH_RESOLUTION - 1; ++y) {
+            for (uint32_t x = 0; x < PATCH_RESOLUTION - 1; ++x) {
+                // convert 2d array indices to 1d array indices
+                uint32_t ul = x + y * width + baseVertIndex;
+                uint32_t ll = x + (y + 1) * width + baseVertIndex;
+                uint32_t lr = (x + 1) + (y + 1) * width + baseVertIndex;
+                uint32_t ur = (x + 1) + y * width + baseVertIndex;
+
+                // top-left triangle
+                indexPtr[0] = ul;
+                indexPtr[1] = ll;
+                indexPtr[2] = ur;
+
+                // bottom-right triangle
+                indexPtr[3] = ll;
+                indexPtr[4] = lr;
+                indexPtr[5] = ur;
+
+                indexPtr += 6; // advance pointer
+            }
+        }
+
+        return static_cast<uint32_t>(indexPtr - start);
+    }
+
+    // coarser levels use cells of strideX x strideY vertices, the grid is treated as if it were
+    // PATCH_RESOLUTION + 1 vertices wide with the extra row and column clamped onto the last one
+    const uint32_t strideY = 1u << std::min(detail, MAX_LONGITUDE_DETAIL);
+    const uint32_t strideX = 1u << std::min(detail + lonDetail, MAX_LONGITUDE_DETAIL);
+    const uint32_t cellsX = (PATCH_RESOLUTION - 2) / strideX + 1; // a stride of 1 has no clamped cell
+    const uint32_t cellsY = (PATCH_RESOLUTION - 2) / strideY + 1;
+
+    auto vert = [width, baseVertIndex](uint32_t x, uint32_t y) {
+        return std::min(x, width - 1) + std::min(y, width - 1) * width + baseVertIndex;
+    };
+    auto tri = [&indexPtr](uint32_t a, uint32_t b, uint32_t c) {
+        if (a != b && b != c && a != c) { // skip triangles collapsed by the clamping
+            indexPtr[0] = a;
+            indexPtr[1] = b;
+            indexPtr[2] = c;
+            indexPtr += 3;
+        }
+    };
+
+    for (uint32_t cy = 0; cy < cellsY; ++cy) {
+        for (uint32_t cx = 0; cx < cellsX; ++cx) {
+            const uint32_t x0 = cx * strideX;
+            const uint32_t y0 = cy * strideY;
+            const uint32_t x1 = x0 + strideX;
+            const uint32_t y1 = y0 + strideY;
+
+            const bool left = cx == 0;
+            const bool right = cx == cellsX - 1;
+            const bool top = cy == 0;
+            const bool bottom = cy == cellsY - 1;
+
+            if (!left && !right && !top && !bottom) {
+                // same winding as the full detail grid
+                tri(vert(x0, y0), vert(x0, y1), vert(x1, y0));
+                tri(vert(x0, y1), vert(x1, y1), vert(x1, y0));
+                continue;
+            }
+
+            // cells on the patch border keep every border vertex so they line up with neighboring
+            // patches of any detail, they are fanned from the cell center. Cells one vertex apart
+            // (after clamping) have no center, they are fanned from a corner on a side without
+            // border vertices
+            const uint32_t cellWidth = std::min(x1, width - 1) - x0;
+            const uint32_t cellHeight = std::min(y1, width - 1) - y0;
+            uint32_t c;
+            if (cellWidth > 1 && cellHeight > 1) {
+                c = vert(x0 + cellWidth / 2, y0 + cellHeight / 2);
+            } else {
+                c = top && cellHeight == 1 ? vert(x0, y1) : vert(x0, y0);
+            }
+
+            uint32_t step = left ? 1 : strideY;
+            for (uint32_t y = y0; y < y1; y += step) {
+                tri(c, vert(x0, y), vert(x0, y + step));
+            }
+
+            step = bottom ? 1 : strideX;
+            for (uint32_t x = x0; x < x1; x += step) {
+                tri(c, vert(x, y1), vert(x + step, y1));
+            }
+
+            step = right ? 1 : strideY;
+            for (uint32_t y = y1; y > y0; y -= step) {
+                tri(c, vert(x1, y), vert(x1, y - step));
+            }
+
+            step = top ? 1 : strideX;
+            for (uint32_t x = x1; x > x0; x -= step) {
+                tri(c, vert(x, y0), vert(x - step, y0));
+            }
+        }
+    }
+
+    return static_cast<uint32_t>(indexPtr - start);
+}
+
+void MarsCore::generatePatchPositions(uint32_t patchIndex, const int16_t* elevation, double scale, Vec3d* positions)
+{
+    const Vec3d ul = getMars2000FromPatchIndex(patchIndex);
+    const Vec3d lr = getLowerRightMars2000FromPatchIndex(patchIndex);
+
+    for (uint32_t y = 0; y < PATCH_RESOLUTION; ++y) {
+        const double lat = ul.x + (lr.x - ul.x) * (static_cast<double>(y) / (PATCH_RESOLUTION - 1));
+        for (uint32_t x = 0; x < PATCH_RESOLUTION; ++x) {
+            Vec3d mars2000;
+            mars2000.x = lat;
+            mars2000.y = ul.y + (lr.y - ul.y) * (static_cast<double>(x) / (PATCH_RESOLUTION - 1));
+            mars2000.z = elevation != nullptr ? static_cast<double>(elevation[x + y * PATCH_RESOLUTION]) : 0.0;
+            *positions++ = toCartesianFromMars2000(mars2000, scale);
+        }
+    }
+}
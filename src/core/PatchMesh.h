@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Mars2000.h"
+
+namespace MarsCore {
+    // indices of the uniform patch grid, each detail level halves the tessellation while the border keeps
+    // every vertex, returns the index count. lonDetail halves the tessellation along longitude only
+    uint32_t generateGridIndices(uint32_t* indexPtr, uint32_t baseVertIndex, uint32_t detail, uint32_t lonDetail = 0);
+
+    // longitude detail that keeps a patch's columns about as far apart as at the equator,
+    // patches narrow with the cosine of their latitude
+    uint32_t getLongitudeDetail(uint32_t patchIndex);
+
+    // cartesian positions of a patch's vertices, rows north to south, displaced by the elevation
+    // (PATCH_RESOLUTION squared samples) or on the ellipsoid if it's null
+    void generatePatchPositions(uint32_t patchIndex, const int16_t* elevation, double scale, Vec3d* positions);
+};
@@ -0,0 +1,104 @@
+#include "PlyWriter.h"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace MarsCore;
+
+constexpr int COUNT_DIGITS = 10; // room for any 32-bit count, zero padded so close() can overwrite it in place
+
+PlyWriter::PlyWriter()
+    : numVertices(0)
+    , numFaces(0)
+    , writingFaces(false)
+{
+}
+
+PlyWriter::~PlyWriter()
+{
+    close();
+}
+
+bool PlyWriter::open(const std::string& path, const std::string& comment)
+{
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    numVertices = 0;
+    numFaces = 0;
+    writingFaces = false;
+
+    // positions are doubles since planet-centered coordinates need more precision than floats have,
+    // the data is written in the host's byte order, which is little endian on every supported platform
+    file << "ply\nformat binary_little_endian 1.0\n";
+    if (!comment.empty()) {
+        file << "comment " << comment << "\n";
+    }
+    file << "element vertex ";
+    vertexCountPos = file.tellp();
+    file << std::string(COUNT_DIGITS, '0') << "\n"
+         << "property double x\nproperty double y\nproperty double z\n"
+         << "element face ";
+    faceCountPos = file.tellp();
+    file << std::string(COUNT_DIGITS, '0') << "\n"
+         << "property list uchar uint vertex_indices\nend_header\n";
+
+    return static_cast<bool>(file);
+}
+
+bool PlyWriter::writeVertices(const Vec3d* positions, size_t count)
+{
+    if (writingFaces) {
+        return false;
+    }
+
+    static_assert(sizeof(Vec3d) == sizeof(double) * 3, "Vec3d must be three packed doubles");
+    file.write(reinterpret_cast<const char*>(positions), count * sizeof(Vec3d));
+    numVertices += count;
+
+    return static_cast<bool>(file);
+}
+
+bool PlyWriter::writeFaces(const uint32_t* indices, size_t numTriangles)
+{
+    writingFaces = true;
+
+    // each face is its vertex count followed by its indices
+    constexpr size_t FACE_BYTES = 1 + sizeof(uint32_t) * 3;
+    std::vector<char> buffer(numTriangles * FACE_BYTES);
+    char* dst = buffer.data();
+    for (size_t i = 0; i < numTriangles; ++i) {
+        *dst++ = 3;
+        std::memcpy(dst, indices + i * 3, sizeof(uint32_t) * 3);
+        dst += sizeof(uint32_t) * 3;
+    }
+
+    file.write(buffer.data(), buffer.size());
+    numFaces += numTriangles;
+
+    return static_cast<bool>(file);
+}
+
+bool PlyWriter::close()
+{
+    if (!file.is_open()) {
+        return true;
+    }
+
+    // fill in the counts left as zeros in the header
+    std::ostringstream vertexCount;
+    vertexCount << std::setw(COUNT_DIGITS) << std::setfill('0') << numVertices;
+    std::ostringstream faceCount;
+    faceCount << std::setw(COUNT_DIGITS) << std::setfill('0') << numFaces;
+    file.seekp(vertexCountPos);
+    file << vertexCount.str();
+    file.seekp(faceCountPos);
+    file << faceCount.str();
+
+    bool ok = static_cast<bool>(file);
+    file.close();
+    return ok && vertexCount.str().size() == COUNT_DIGITS && faceCount.str().size() == COUNT_DIGITS;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "Mars2000.h"
+
+namespace MarsCore {
+    // streams a triangle mesh into a binary PLY file without holding it in memory. PLY lists every
+    // vertex before the first face, so all vertices must be written first, and the counts in the
+    // header are only filled in by close()
+    class PlyWriter {
+    public:
+        PlyWriter();
+        ~PlyWriter();
+
+        bool open(const std::string& path, const std::string& comment = "");
+        bool writeVertices(const Vec3d* positions, size_t count);
+        // indices are into all vertices written, three per triangle
+        bool writeFaces(const uint32_t* indices, size_t numTriangles);
+        bool close();
+
+        uint64_t getNumVertices() const { return numVertices; }
+        uint64_t getNumFaces() const { return numFaces; }
+
+    protected:
+        std::ofstream file;
+        std::streampos vertexCountPos;
+        std::streampos faceCountPos;
+        uint64_t numVertices;
+        uint64_t numFaces;
+        bool writingFaces;
+    };
+};
@@ -0,0 +1,83 @@
+#include "TileDecode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace MarsCore;
+
+size_t MarsCore::getElevationTileSize(uint32_t resolution)
+{
+    return static_cast<size_t>(resolution) * resolution * sizeof(int16_t);
+}
+
+size_t MarsCore::getImageryTileSize(uint32_t resolution)
+{
+    return static_cast<size_t>(resolution) * resolution * 3 * sizeof(uint8_t);
+}
+
+bool MarsCore::decodeElevation(const unsigned char* bytes, size_t size, uint32_t resolution, std::vector<int16_t>& data)
+{
+    if (size != getElevationTileSize(resolution)) {
+        return false;
+    }
+
+    data.resize(static_cast<size_t>(resolution) * resolution);
+    for (size_t i = 0; i < size; i += 2) {
+        // bytes are in big-endian int16 format
+        int16_t e = static_cast<int16_t>(bytes[i]) << 8 | static_cast<int16_t>(bytes[i + 1]);
+        data[i / 2] = e;
+    }
+
+    return true;
+}
+
+bool MarsCore::decodeImagery(const unsigned char* bytes, size_t size, uint32_t resolution, std::vector<uint8_t>& data, uint32_t channels)
+{
+    if (size != getImageryTileSize(resolution)) {
+        return false;
+    }
+
+    if (channels == 3) {
+        data.assign(bytes, bytes + size);
+        return true;
+    }
+
+    const size_t numTexels = size / 3;
+    data.resize(numTexels * 4);
+    uint8_t* dst = data.data();
+    for (size_t i = 0; i < numTexels; ++i) {
+        // one little-endian word per texel, which the compiler turns into wide stores
+        const unsigned char* texel = bytes + i * 3;
+        uint32_t rgba = texel[0] | (texel[1] << 8) | (texel[2] << 16) | 0xFF000000u;
+        std::memcpy(dst + i * 4, &rgba, 4);
+    }
+
+    return true;
+}
+
+void MarsCore::resampleElevation(const std::vector<int16_t>& src, uint32_t srcResolution, std::vector<int16_t>& dst, uint32_t dstResolution)
+{
+    dst.resize(dstResolution * dstResolution);
+
+    // both grids span the whole tile, so their corner samples line up
+    const double scale = static_cast<double>(srcResolution - 1) / (dstResolution - 1);
+    for (uint32_t y = 0; y < dstResolution; ++y) {
+        double sy = y * scale;
+        uint32_t y0 = std::min(static_cast<uint32_t>(sy), srcResolution - 1);
+        uint32_t y1 = std::min(y0 + 1, srcResolution - 1);
+        double ty = sy - y0;
+
+        for (uint32_t x = 0; x < dstResolution; ++x) {
+            double sx = x * scale;
+            uint32_t x0 = std::min(static_cast<uint32_t>(sx), srcResolution - 1);
+            uint32_t x1 = std::min(x0 + 1, srcResolution - 1);
+            double tx = sx - x0;
+
+            // bilinear interpolation of the four surrounding samples
+            double top = src[x0 + y0 * srcResolution] * (1.0 - tx) + src[x1 + y0 * srcResolution] * tx;
+            double bottom = src[x0 + y1 * srcResolution] * (1.0 - tx) + src[x1 + y1 * srcResolution] * tx;
+            dst[x + y * dstResolution] = static_cast<int16_t>(std::lround(top * (1.0 - ty) + bottom * ty));
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MarsCore {
+    // decode tile responses from the database, false if the size doesn't match the resolution
+    bool decodeElevation(const unsigned char* bytes, size_t size, uint32_t resolution, std::vector<int16_t>& data);
+    // imagery is served as RGB, 4 channels expands it to opaque RGBA
+    bool decodeImagery(const unsigned char* bytes, size_t size, uint32_t resolution, std::vector<uint8_t>& data, uint32_t channels = 3);
+    size_t getElevationTileSize(uint32_t resolution);
+    size_t getImageryTileSize(uint32_t resolution);
+
+    void resampleElevation(const std::vector<int16_t>& src, uint32_t srcResolution, std::vector<int16_t>& dst, uint32_t dstResolution);
+};
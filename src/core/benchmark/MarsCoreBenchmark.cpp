@@ -0,0 +1,191 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "AdaptiveMesh.h"
+#include "ImageMips.h"
+#include "Mars2000.h"
+#include "MarsConstants.h"
+#include "PatchMesh.h"
+#include "TileDecode.h"
+
+using namespace MarsCore;
+
+constexpr double MIN_SECONDS = 0.5; // each benchmark repeats until it has run at least this long
+
+// keeps results alive so the optimizer can't drop the benchmarked work
+static volatile double sink;
+
+template <typename F>
+static void run(const std::string& name, const std::string& unit, double unitsPerCall, F&& f)
+{
+    size_t calls = 0;
+    double elapsed = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    while (elapsed < MIN_SECONDS) {
+        f();
+        ++calls;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::cout << name << ": " << elapsed / calls * 1e6 << " us/call, "
+        << unitsPerCall * calls / elapsed << " " << unit << "/sec" << std::endl;
+}
+
+// smooth hills with meter scale noise, standing in for a real elevation tile
+static std::vector<int16_t> makeElevation(uint32_t resolution, unsigned int seed)
+{
+    std::default_random_engine gen(seed);
+    std::normal_distribution<double> noise(0.0, 1.5);
+
+    std::vector<int16_t> elevation(resolution * resolution);
+    for (uint32_t y = 0; y < resolution; ++y) {
+        for (uint32_t x = 0; x < resolution; ++x) {
+            double h = 1000.0 * std::sin(x * 0.02) + 800.0 * std::cos(y * 0.03) + noise(gen);
+            elevation[x + y * resolution] = static_cast<int16_t>(std::lround(h));
+        }
+    }
+
+    return elevation;
+}
+
+int main(int argc, char** argv)
+{
+    const double scale = argc > 1 ? std::atof(argv[1]) : 0.1;
+    std::default_random_engine gen(0);
+
+    // coordinate conversions over random points on the surface
+    const size_t NUM_POINTS = 10000;
+    std::uniform_real_distribution<double> lat(-90.0, 90.0);
+    std::uniform_real_distribution<double> lon(-180.0, 180.0);
+    std::uniform_real_distribution<double> elev(-8000.0, 21000.0);
+    std::vector<Vec3d> mars2000(NUM_POINTS);
+    std::vector<Vec3d> cartesian(NUM_POINTS);
+    for (size_t i = 0; i < NUM_POINTS; ++i) {
+        mars2000[i] = { lat(gen), lon(gen), elev(gen) };
+        cartesian[i] = toCartesianFromMars2000(mars2000[i], scale);
+    }
+
+    run("toCartesianFromMars2000", "points", NUM_POINTS, [&]() {
+        double sum = 0.0;
+        for (const Vec3d& p : mars2000) {
+            sum += toCartesianFromMars2000(p, scale).x;
+        }
+        sink = sum;
+    });
+
+    run("toMars2000FromCartesian", "points", NUM_POINTS, [&]() {
+        double sum = 0.0;
+        for (const Vec3d& p : cartesian) {
+            sum += toMars2000FromCartesian(p, scale).x;
+        }
+        sink = sum;
+    });
+
+    run("getPatchIndexFromMars2000", "points", NUM_POINTS, [&]() {
+        uint64_t sum = 0;
+        for (const Vec3d& p : mars2000) {
+            sum += getPatchIndexFromMars2000(p);
+        }
+        sink = static_cast<double>(sum);
+    });
+
+    // tile decoding, from the big-endian bytes served by the database
+    std::vector<int16_t> elevation = makeElevation(PATCH_RESOLUTION, 1);
+    std::vector<unsigned char> elevBytes(getElevationTileSize(PATCH_RESOLUTION));
+    for (size_t i = 0; i < elevation.size(); ++i) {
+        elevBytes[i * 2] = static_cast<unsigned char>(static_cast<uint16_t>(elevation[i]) >> 8);
+        elevBytes[i * 2 + 1] = static_cast<unsigned char>(static_cast<uint16_t>(elevation[i]) & 0xFF);
+    }
+    std::vector<unsigned char> imgBytes(getImageryTileSize(PATCH_RESOLUTION), 0x80);
+
+    std::vector<int16_t> decodedElev;
+    run("decodeElevation", "MB", elevBytes.size() / 1e6, [&]() {
+        decodeElevation(elevBytes.data(), elevBytes.size(), PATCH_RESOLUTION, decodedElev);
+        sink = decodedElev[0];
+    });
+
+    std::vector<uint8_t> decodedImg;
+    run("decodeImagery", "MB", imgBytes.size() / 1e6, [&]() {
+        decodeImagery(imgBytes.data(), imgBytes.size(), PATCH_RESOLUTION, decodedImg);
+        sink = decodedImg[0];
+    });
+
+    std::vector<uint8_t> decodedRGBA;
+    run("decodeImagery RGBA", "MB", imgBytes.size() / 1e6, [&]() {
+        decodeImagery(imgBytes.data(), imgBytes.size(), PATCH_RESOLUTION, decodedRGBA, 4);
+        sink = decodedRGBA[0];
+    });
+
+    // the RGBA chain is filtered with SSE2 where available
+    for (uint32_t channels = 3; channels <= 4; ++channels) {
+        std::vector<uint8_t> mipChain(channels == 3 ? decodedImg : decodedRGBA);
+        run("buildMipChain " + std::to_string(channels) + " channels", "tiles", 1.0, [&]() {
+            buildMipChain(mipChain, PATCH_RESOLUTION, channels);
+            sink = mipChain.back();
+        });
+    }
+
+    std::vector<int16_t> coarse = makeElevation(32, 2);
+    std::vector<int16_t> resampled;
+    run("resampleElevation 32 -> 256", "tiles", 1.0, [&]() {
+        resampleElevation(coarse, 32, resampled, PATCH_RESOLUTION);
+        sink = resampled[0];
+    });
+
+    // mesh generation
+    std::vector<uint32_t> indices(NUM_TRIS_PER_PATCH * 3);
+    for (uint32_t detail = 0; detail <= 2; ++detail) {
+        run("generateGridIndices detail " + std::to_string(detail), "patches", 1.0, [&]() {
+            sink = generateGridIndices(&indices[0], 0, detail);
+        });
+    }
+
+    std::vector<Vec3d> positions(NUM_VERTS_PER_PATCH);
+    run("generatePatchPositions", "patches", 1.0, [&]() {
+        generatePatchPositions(100 + 90 * PATCH_GRID_WIDTH, elevation.data(), scale, positions.data());
+        sink = positions.back().x;
+    });
+
+    run("AdaptiveMesh build", "patches", 1.0, [&]() {
+        AdaptiveMesh mesh(elevation);
+        sink = mesh.countTriangles(1e9f);
+    });
+
+    AdaptiveMesh mesh(elevation);
+    for (float maxError : { 1.0f, 2.0f, 8.0f }) {
+        uint32_t count = mesh.generateIndices(&indices[0], 0, maxError);
+        run("AdaptiveMesh generateIndices " + std::to_string(static_cast<int>(maxError)) + " m (" + std::to_string(count / 3) + " triangles, "
+                + std::to_string(100 * count / 3 / NUM_TRIS_PER_PATCH) + "% of the grid)",
+            "patches", 1.0, [&]() {
+                sink = mesh.generateIndices(&indices[0], 0, maxError);
+            });
+    }
+
+    // triangle reduction on real elevation tiles saved from the database (e.g. "elevation?id=32580"),
+    // passed after the scale, synthetic terrain says little about it
+    for (int i = 2; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ios::binary);
+        std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::vector<int16_t> tile;
+        if (!decodeElevation(bytes.data(), bytes.size(), PATCH_RESOLUTION, tile)) {
+            std::cerr << argv[i] << ": not a " << PATCH_RESOLUTION << "x" << PATCH_RESOLUTION << " elevation tile" << std::endl;
+            continue;
+        }
+
+        AdaptiveMesh tileMesh(tile);
+        std::cout << argv[i] << ":";
+        for (float maxError : { 1.0f, 2.0f, 4.0f, 8.0f }) {
+            std::cout << " " << maxError << " m " << 100.0 * tileMesh.countTriangles(maxError) / NUM_TRIS_PER_PATCH << "%";
+        }
+        std::cout << " of the grid's triangles" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AdaptiveMesh.h"
+#include "ImageMips.h"
+#include "Mars2000.h"
+#include "MarsConstants.h"
+#include "PatchMesh.h"
+#include "TileDecode.h"
+
+using namespace MarsCore;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                          \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            ++failures;                                                                           \
+        }                                                                                         \
+    } while (false)
+
+static void testMars2000RoundTrip()
+{
+    // the conversion back is singular at the poles themselves
+    std::default_random_engine gen(0);
+    std::uniform_real_distribution<double> lat(-89.9, 89.9);
+    std::uniform_real_distribution<double> lon(-179.9, 179.9);
+    std::uniform_real_distribution<double> elev(-8000.0, 21000.0);
+
+    for (double scale : { 1.0, 0.1 }) {
+        for (int i = 0; i < 10000; ++i) {
+            const Vec3d p = { lat(gen), lon(gen), elev(gen) };
+            const Vec3d q = toMars2000FromCartesian(toCartesianFromMars2000(p, scale), scale);
+            CHECK(std::abs(q.x - p.x) < 1e-9);
+            CHECK(std::abs(q.y - p.y) < 1e-9);
+            CHECK(std::abs(q.z / scale - p.z) < 1e-3);
+        }
+    }
+
+    // on the ellipsoid the equator is at the semi-major axis
+    const Vec3d equator = toCartesianFromMars2000({ 0.0, 0.0, 0.0 }, 1.0);
+    CHECK(std::abs(equator.x - MARS_SEMIMAJOR_AXIS) < 1e-6);
+    CHECK(std::abs(equator.y) < 1e-6 && std::abs(equator.z) < 1e-6);
+}
+
+static void testPatchIndexClamps()
+{
+    CHECK(getPatchIndexFromMars2000({ 90.0, -180.0, 0.0 }) == 0);
+    CHECK(getPatchIndexFromMars2000({ 89.5, 179.5, 0.0 }) == PATCH_GRID_WIDTH - 1);
+
+    // the east edge and the south pole belong to the last patch in each direction
+    CHECK(getPatchIndexFromMars2000({ 89.5, 180.0, 0.0 }) == PATCH_GRID_WIDTH - 1);
+    CHECK(getPatchIndexFromMars2000({ -90.0, -180.0, 0.0 }) == (PATCH_GRID_HEIGHT - 1) * PATCH_GRID_WIDTH);
+    CHECK(getPatchIndexFromMars2000({ -90.0, 180.0, 0.0 }) == NUM_PATCHES - 1);
+
+    // and every patch maps back onto itself through its upper left corner
+    for (uint32_t index = 0; index < NUM_PATCHES; index += 37) {
+        Vec3d corner = getMars2000FromPatchIndex(index);
+        CHECK(getPatchIndexFromMars2000({ corner.x - 0.5, corner.y + 0.5, 0.0 }) == index);
+    }
+}
+
+static void testNeighborPatchIndex()
+{
+    const uint32_t last = PATCH_GRID_WIDTH - 1;
+    const uint32_t bottom = PATCH_GRID_HEIGHT - 1;
+
+    CHECK(getNeighborPatchIndex(10, 20, 0, 0) == 10 + 20 * PATCH_GRID_WIDTH);
+    CHECK(getNeighborPatchIndex(10, 20, 3, -2) == 13 + 18 * PATCH_GRID_WIDTH);
+
+    // longitude wraps around in both directions
+    CHECK(getNeighborPatchIndex(last, 20, 1, 0) == 20 * PATCH_GRID_WIDTH);
+    CHECK(getNeighborPatchIndex(0, 20, -1, 0) == last + 20 * PATCH_GRID_WIDTH);
+    CHECK(getNeighborPatchIndex(0, 20, -static_cast<int32_t>(PATCH_GRID_WIDTH) * 3, 0) == 20 * PATCH_GRID_WIDTH);
+
+    // crossing a pole continues down the opposite meridian
+    CHECK(getNeighborPatchIndex(10, 0, 0, -1) == 10 + PATCH_GRID_WIDTH / 2);
+    CHECK(getNeighborPatchIndex(10, 0, 0, -2) == 10 + PATCH_GRID_WIDTH / 2 + PATCH_GRID_WIDTH);
+    CHECK(getNeighborPatchIndex(10, bottom, 0, 1) == 10 + PATCH_GRID_WIDTH / 2 + bottom * PATCH_GRID_WIDTH);
+    CHECK(getNeighborPatchIndex(last, bottom, 0, 1) == PATCH_GRID_WIDTH / 2 - 1 + bottom * PATCH_GRID_WIDTH);
+
+    // offsets past the whole grid are clamped onto it
+    for (int32_t dy : { -1000, -400, 400, 1000 }) {
+        CHECK(getNeighborPatchIndex(10, 20, 0, dy) < NUM_PATCHES);
+    }
+}
+
+static void testPatchRings()
+{
+    std::vector<std::pair<uint32_t, int32_t>> rings;
+
+    // at the equator the set is a square of rings
+    const uint32_t equator = 100 + (PATCH_GRID_HEIGHT / 2) * PATCH_GRID_WIDTH;
+    getPatchRings(equator, 3, 4.0, rings);
+    CHECK(rings.size() == 7 * 7);
+    CHECK(std::count(rings.begin(), rings.end(), std::make_pair(equator, 0)) == 1);
+
+    // towards the poles rows widen, but no patch is listed twice and each has its closest ring
+    for (uint32_t row : { 0u, 1u, 30u, PATCH_GRID_HEIGHT - 1 }) {
+        const uint32_t center = 10 + row * PATCH_GRID_WIDTH;
+        getPatchRings(center, 3, 4.0, rings);
+        std::map<uint32_t, int32_t> unique(rings.begin(), rings.end());
+        CHECK(unique.size() == rings.size());
+        CHECK(unique[center] == 0);
+        CHECK(rings.size() > 7 * 7 && rings.size() <= 7 * (2 * 12 + 1));
+        for (auto& entry : rings) {
+            CHECK(entry.first < NUM_PATCHES && entry.second >= 0 && entry.second <= 3);
+        }
+    }
+}
+
+static double getDistance(const Vec3d& a, const Vec3d& b)
+{
+    return std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+}
+
+static void testPatchPositions()
+{
+    const uint32_t n = PATCH_RESOLUTION;
+    std::vector<Vec3d> west(NUM_VERTS_PER_PATCH);
+    std::vector<Vec3d> east(NUM_VERTS_PER_PATCH);
+
+    // neighboring patches share their edges, including across the antimeridian and in the last row
+    for (uint32_t row : { 0u, 45u, PATCH_GRID_HEIGHT - 1 }) {
+        for (uint32_t column : { 10u, PATCH_GRID_WIDTH - 1 }) {
+            const uint32_t index = column + row * PATCH_GRID_WIDTH;
+            const uint32_t next = getNeighborPatchIndex(column, row, 1, 0);
+            generatePatchPositions(index, nullptr, 1.0, west.data());
+            generatePatchPositions(next, nullptr, 1.0, east.data());
+
+            double gap = 0.0;
+            for (uint32_t y = 0; y < n; ++y) {
+                gap = std::max(gap, getDistance(west[n - 1 + y * n], east[y * n]));
+            }
+            CHECK(gap < 1e-6);
+
+            // and span one degree, about 59 km along a meridian
+            const double height = getDistance(west[0], west[(n - 1) * n]);
+            CHECK(height > 58000.0 && height < 60000.0);
+        }
+    }
+
+    const Vec3d lr = getLowerRightMars2000FromPatchIndex(NUM_PATCHES - 1);
+    CHECK(lr.x == -90.0 && lr.y == 180.0);
+}
+
+static void testDecoders()
+{
+    const size_t elevSize = getElevationTileSize(PATCH_RESOLUTION);
+    const size_t imgSize = getImageryTileSize(PATCH_RESOLUTION);
+    CHECK(elevSize == PATCH_RESOLUTION * PATCH_RESOLUTION * 2);
+    CHECK(imgSize == PATCH_RESOLUTION * PATCH_RESOLUTION * 3);
+
+    // truncated or oversized responses are rejected
+    std::vector<unsigned char> bytes(std::max(elevSize, imgSize) + 1, 0);
+    std::vector<int16_t> elevation;
+    std::vector<uint8_t> imagery;
+    CHECK(!decodeElevation(bytes.data(), elevSize - 1, PATCH_RESOLUTION, elevation));
+    CHECK(!decodeElevation(bytes.data(), elevSize + 1, PATCH_RESOLUTION, elevation));
+    CHECK(!decodeElevation(bytes.data(), elevSize, 32, elevation));
+    CHECK(!decodeImagery(bytes.data(), imgSize - 1, PATCH_RESOLUTION, imagery));
+    CHECK(!decodeImagery(bytes.data(), imgSize + 1, PATCH_RESOLUTION, imagery, 4));
+    CHECK(!decodeImagery(bytes.data(), elevSize, PATCH_RESOLUTION, imagery));
+
+    // elevation is big-endian
+    bytes[0] = 0xFF;
+    bytes[1] = 0x38;
+    bytes[2] = 0x01;
+    bytes[3] = 0x02;
+    CHECK(decodeElevation(bytes.data(), elevSize, PATCH_RESOLUTION, elevation));
+    CHECK(elevation.size() == NUM_VERTS_PER_PATCH);
+    CHECK(elevation[0] == -200 && elevation[1] == 0x0102);
+
+    // imagery is expanded to opaque RGBA
+    CHECK(decodeImagery(bytes.data(), imgSize, PATCH_RESOLUTION, imagery, 4));
+    CHECK(imagery.size() == NUM_VERTS_PER_PATCH * 4);
+    CHECK(imagery[0] == 0xFF && imagery[1] == 0x38 && imagery[2] == 0x01 && imagery[3] == 0xFF);
+    CHECK(imagery[4] == 0x02 && imagery[7] == 0xFF);
+}
+
+// every vertex of the patch is covered exactly once by triangles wound like the full detail grid,
+// and the only unpaired edges are the unit steps along the border, so neighbors of any mesh share them
+static void checkPatchMesh(const std::vector<uint32_t>& indices, uint32_t count, const std::string& name)
+{
+    const int64_t n = PATCH_RESOLUTION;
+    bool valid = count % 3 == 0 && count > 0;
+    int64_t doubleArea = 0;
+    std::map<std::pair<uint32_t, uint32_t>, int> edges;
+
+    for (uint32_t i = 0; valid && i < count; i += 3) {
+        const uint32_t* tri = &indices[i];
+        if (tri[0] >= NUM_VERTS_PER_PATCH || tri[1] >= NUM_VERTS_PER_PATCH || tri[2] >= NUM_VERTS_PER_PATCH) {
+            valid = false;
+            break;
+        }
+
+        const int64_t ax = tri[0] % n, ay = tri[0] / n;
+        const int64_t bx = tri[1] % n, by = tri[1] / n;
+        const int64_t cx = tri[2] % n, cy = tri[2] / n;
+        const int64_t cross = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+        if (cross >= 0) {
+            valid = false; // degenerate or wound the other way
+            break;
+        }
+        doubleArea -= cross;
+
+        for (int e = 0; e < 3; ++e) {
+            uint32_t a = tri[e];
+            uint32_t b = tri[(e + 1) % 3];
+            edges[{ std::min(a, b), std::max(a, b) }]++;
+        }
+    }
+
+    size_t borderEdges = 0;
+    for (auto& edge : edges) {
+        if (!valid) {
+            break;
+        }
+
+        const int64_t ax = edge.first.first % n, ay = edge.first.first / n;
+        const int64_t bx = edge.first.second % n, by = edge.first.second / n;
+        const bool onBorder = (ax == bx && (ax == 0 || ax == n - 1)) || (ay == by && (ay == 0 || ay == n - 1));
+        if (edge.second == 1) {
+            // a T-junction or a hole shows up as an unpaired edge inside or a long one on the border
+            valid = onBorder && std::abs(ax - bx) + std::abs(ay - by) == 1;
+            ++borderEdges;
+        } else {
+            valid = edge.second == 2 && !onBorder;
+        }
+    }
+
+    valid = valid && doubleArea == (n - 1) * (n - 1) * 2 && borderEdges == static_cast<size_t>(n - 1) * 4;
+    if (!valid) {
+        std::cerr << name << ": the mesh doesn't cover the patch or cracks at its border" << std::endl;
+        ++failures;
+    }
+}
+
+static void testGridIndices()
+{
+    std::vector<uint32_t> indices(NUM_TRIS_PER_PATCH * 3);
+
+    uint32_t count = generateGridIndices(indices.data(), 0, 0);
+    CHECK(count == NUM_TRIS_PER_PATCH * 3);
+
+    for (uint32_t detail = 0; detail <= 5; ++detail) {
+        for (uint32_t lonDetail = 0; lonDetail <= 8 - std::min(detail, 8u); lonDetail += 2) {
+            count = generateGridIndices(indices.data(), 0, detail, lonDetail);
+            checkPatchMesh(indices, count, "grid detail " + std::to_string(detail) + " longitude detail " + std::to_string(lonDetail));
+        }
+    }
+
+    // the base vertex only offsets the indices
+    std::vector<uint32_t> offset(NUM_TRIS_PER_PATCH * 3);
+    count = generateGridIndices(indices.data(), 0, 2);
+    CHECK(generateGridIndices(offset.data(), 1000, 2) == count);
+    CHECK(offset[0] == indices[0] + 1000 && offset[count - 1] == indices[count - 1] + 1000);
+
+    // the longitude detail only increases towards the poles
+    CHECK(getLongitudeDetail(90 * PATCH_GRID_WIDTH) == 0);
+    CHECK(getLongitudeDetail(0) > getLongitudeDetail(30 * PATCH_GRID_WIDTH));
+    CHECK(getLongitudeDetail(0) == getLongitudeDetail((PATCH_GRID_HEIGHT - 1) * PATCH_GRID_WIDTH));
+}
+
+static void testAdaptiveMesh()
+{
+    std::default_random_engine gen(1);
+    std::normal_distribution<double> noise(0.0, 4.0);
+
+    std::vector<int16_t> flat(NUM_VERTS_PER_PATCH, 100);
+    std::vector<int16_t> rough(NUM_VERTS_PER_PATCH);
+    for (uint32_t y = 0; y < PATCH_RESOLUTION; ++y) {
+        for (uint32_t x = 0; x < PATCH_RESOLUTION; ++x) {
+            rough[x + y * PATCH_RESOLUTION] = static_cast<int16_t>(std::lround(1000.0 * std::sin(x * 0.05) + 600.0 * std::cos(y * 0.03) + noise(gen)));
+        }
+    }
+
+    std::vector<uint32_t> indices(NUM_TRIS_PER_PATCH * 3);
+    for (auto* elevation : { &flat, &rough }) {
+        AdaptiveMesh mesh(*elevation);
+        for (float maxError : { 0.0f, 2.0f, 64.0f, 1e9f }) {
+            uint32_t count = mesh.generateIndices(indices.data(), 0, maxError);
+            CHECK(count == mesh.countTriangles(maxError) * 3);
+            checkPatchMesh(indices, count, std::string(elevation == &flat ? "flat" : "rough") + " adaptive mesh at " + std::to_string(maxError) + " m");
+        }
+
+        // no tolerance reproduces every vertex, and a looser one never adds triangles
+        CHECK(mesh.countTriangles(2.0f) <= mesh.countTriangles(0.0f));
+        CHECK(mesh.countTriangles(64.0f) <= mesh.countTriangles(2.0f));
+    }
+
+    CHECK(AdaptiveMesh(flat).countTriangles(0.0f) < AdaptiveMesh(rough).countTriangles(0.0f));
+}
+
+static void testMipChain()
+{
+    CHECK(getNumMipLevels(1) == 1);
+    CHECK(getNumMipLevels(32) == 6);
+    CHECK(getNumMipLevels(PATCH_RESOLUTION) == 9);
+    CHECK(getMipResolution(PATCH_RESOLUTION, 0) == PATCH_RESOLUTION);
+    CHECK(getMipResolution(PATCH_RESOLUTION, 8) == 1);
+    CHECK(getMipResolution(PATCH_RESOLUTION, 12) == 1);
+
+    // levels are packed one after another, finest first
+    CHECK(getMipOffset(PATCH_RESOLUTION, 0, 4) == 0);
+    CHECK(getMipOffset(PATCH_RESOLUTION, 1, 4) == PATCH_RESOLUTION * PATCH_RESOLUTION * 4);
+    CHECK(getMipOffset(PATCH_RESOLUTION, 9, 4) == 87381 * 4);
+    CHECK(getMipOffset(32, 6, 3) == 1365 * 3);
+
+    for (uint32_t channels : { 3u, 4u }) {
+        for (uint32_t resolution : { PATCH_RESOLUTION, 32u, 1u }) {
+            // a uniform color stays uniform in every level
+            std::vector<uint8_t> chain(resolution * resolution * channels);
+            for (size_t i = 0; i < chain.size(); ++i) {
+                chain[i] = static_cast<uint8_t>(10 + i % channels);
+            }
+
+            buildMipChain(chain, resolution, channels);
+            CHECK(chain.size() == getMipOffset(resolution, getNumMipLevels(resolution), channels));
+            bool uniform = true;
+            for (size_t i = 0; i < chain.size(); ++i) {
+                uniform = uniform && chain[i] == 10 + i % channels;
+            }
+            CHECK(uniform);
+        }
+    }
+
+    // each level averages 2x2 texels of the one before
+    std::vector<uint8_t> checker = { 0, 0, 0, 0, 200, 200, 200, 200, 200, 200, 200, 200, 0, 0, 0, 0 };
+    buildMipChain(checker, 2, 4);
+    CHECK(checker.size() == 20);
+    CHECK(checker[16] == 100 && checker[19] == 100);
+}
+
+int main()
+{
+    const std::vector<std::pair<const char*, std::function<void()>>> tests = {
+        { "Mars2000 round trip", testMars2000RoundTrip },
+        { "patch index clamps", testPatchIndexClamps },
+        { "neighbor patch index", testNeighborPatchIndex },
+        { "patch rings", testPatchRings },
+        { "patch positions", testPatchPositions },
+        { "tile decoders", testDecoders },
+        { "grid indices", testGridIndices },
+        { "adaptive mesh", testAdaptiveMesh },
+        { "mip chain", testMipChain },
+    };
+
+    for (auto& test : tests) {
+        const int before = failures;
+        test.second();
+        std::cout << (failures == before ? "passed: " : "FAILED: ") << test.first << std::endl;
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -7,6 +7,9 @@
 #include <vector>
 #include <memory>
 #include "GLViewMarsVisualization.h" //GLView subclass instantiated to drive this simulation
+#include "TerrainExporter.h" //Command line terrain export, runs without the engine
+#include "SharedTileCache.h" //Shared memory tile cache, removed from the command line after a crash
+#include "Constants.h"
 
 /// Saves the in passed params argc and argv in a vector of strings.
 std::vector< std::string > saveInputParams( int argc, char** argv );
@@ -21,6 +24,19 @@ std::vector< std::string > saveInputParams( int argc, char** argv );
 int main( int argc, char* argv[] )
 {
    std::vector< std::string > args = saveInputParams( argc, argv ); ///< Command line arguments passed via argc and argv, reserved to size of argc
+
+   //Exporting terrain doesn't need a window, it only fetches tiles and writes the mesh
+   if( args.size() > 1 && args[1] == "--export-ply" )
+      return Aftr::TerrainExporter::run( args );
+
+   //Instances that crashed leave the shared tile cache behind
+   if( args.size() > 1 && args[1] == "--clear-tile-cache" )
+   {
+      bool removed = Aftr::SharedTileCache::remove( Aftr::SHARED_TILE_CACHE_NAME );
+      std::cout << ( removed ? "Removed the shared tile cache" : "There is no shared tile cache" ) << std::endl;
+      return 0;
+   }
+
    int simStatus = 0;
 
    do